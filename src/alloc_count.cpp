@@ -0,0 +1,130 @@
+#include "alloc_count.h"
+
+#ifdef SYNTH_COUNT_ALLOCS
+
+#include <new>
+#include <errno.h>
+#include <stdlib.h>
+
+// per thread, so controllers rendering on different threads don't see
+// each other's allocations
+static thread_local uint64_t alloc_count = 0;
+
+uint64_t getAllocCount()
+{
+  return alloc_count;
+}
+
+void addAllocCount(uint64_t count)
+{
+  alloc_count += count;
+}
+
+#ifdef __GLIBC__
+
+// glibc lets a program replace malloc, which catches what operator new and
+// C code (STK's StkFrames among it) allocate alike
+extern "C"
+{
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *p, size_t size);
+void *__libc_memalign(size_t align, size_t size);
+void __libc_free(void *p);
+
+void *malloc(size_t size) noexcept
+{
+  alloc_count++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) noexcept
+{
+  alloc_count++;
+  return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) noexcept
+{
+  alloc_count++;
+  return __libc_realloc(p, size);
+}
+
+void *memalign(size_t align, size_t size) noexcept
+{
+  alloc_count++;
+  return __libc_memalign(align, size);
+}
+
+void *aligned_alloc(size_t align, size_t size) noexcept
+{
+  alloc_count++;
+  return __libc_memalign(align, size);
+}
+
+int posix_memalign(void **out, size_t align, size_t size) noexcept
+{
+  alloc_count++;
+  void *p = __libc_memalign(align, size);
+  if (p == nullptr) return ENOMEM;
+  *out = p;
+  return 0;
+}
+
+void free(void *p) noexcept
+{
+  __libc_free(p);
+}
+}
+
+#else
+
+// elsewhere only C++ allocations are seen
+void *operator new(size_t size)
+{
+  alloc_count++;
+  void *p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, size_t /* size */) noexcept
+{
+  free(p);
+}
+
+void operator delete[](void *p, size_t /* size */) noexcept
+{
+  free(p);
+}
+
+#endif // __GLIBC__
+
+#else
+
+uint64_t getAllocCount()
+{
+  return 0;
+}
+
+void addAllocCount(uint64_t /* count */)
+{
+
+}
+
+#endif // SYNTH_COUNT_ALLOCS
@@ -0,0 +1,17 @@
+#ifndef SYNTH_ALLOC_COUNT_H
+#define SYNTH_ALLOC_COUNT_H
+
+#include <stdint.h>
+
+/*
+  Number of heap allocations made so far by the calling thread, including
+  jobs it handed to a WorkerPool. Only counted when built with
+  SYNTH_COUNT_ALLOCS (cmake -DSYNTH_COUNT_ALLOCS=ON); otherwise always 0.
+  Used to check that the render loop does not allocate once it has warmed
+  up (see SeqController::tick()).
+*/
+uint64_t getAllocCount();
+// count allocations made elsewhere on this thread's behalf
+void addAllocCount(uint64_t count);
+
+#endif // SYNTH_ALLOC_COUNT_H
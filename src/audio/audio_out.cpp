@@ -1,26 +1,22 @@
 #include "audio_out.h"
 
 #include <SDL2/SDL.h>
+#include <string.h>
 
-/*
- TODO:
-    Make a better low-latency queue implementation than is provided by default.
- */
-
-SDLAudioOut::SDLAudioOut(float samplerate, uint32_t bufsize) : stk::WvOut()
+SDLAudioOut::SDLAudioOut(float samplerate, uint32_t latency, uint32_t bufsize)
+  : stk::WvOut(), ring(latency * 2)
 {
   SDL_Init(SDL_INIT_AUDIO);
 
-  audio_spec.callback = nullptr;
+  audio_spec.callback = &SDLAudioOut::callback;
   audio_spec.channels = 2;
-  audio_spec.format = AUDIO_S16;
-  audio_spec.samples = 4096;
+  audio_spec.format = AUDIO_S16SYS;
+  audio_spec.samples = bufsize;
   audio_spec.freq = (int)samplerate;
-  audio_spec.size = bufsize;
-  audio_spec.userdata = nullptr;
+  audio_spec.userdata = this;
 
+  // SDL converts if the device wants something else
   dev_id = SDL_OpenAudioDevice(nullptr, 0, &audio_spec, nullptr, 0);
-  SDL_PauseAudioDevice(dev_id, 0);
   if (dev_id <= 0)
   {
     err = true;
@@ -30,37 +26,75 @@ SDLAudioOut::SDLAudioOut(float samplerate, uint32_t bufsize) : stk::WvOut()
 
 SDLAudioOut::~SDLAudioOut()
 {
-  SDL_CloseAudioDevice(dev_id);
+  if (dev_id > 0) SDL_CloseAudioDevice(dev_id);
 }
 
-static bool writeData(int dev_id, int16_t *data, uint32_t size)
+void SDLAudioOut::callback(void *userdata, Uint8 *stream, int len)
 {
-  if (SDL_QueueAudio(dev_id, data, size) < 0)
+  SDLAudioOut *out = static_cast<SDLAudioOut *>(userdata);
+  int16_t *samples = reinterpret_cast<int16_t *>(stream);
+  uint32_t wanted = len / sizeof(int16_t);
+  uint32_t got = out->ring.read(samples, wanted);
+  if (got < wanted)
   {
-    printf("Error writing data: %s\n", SDL_GetError());
-    return false;
+    memset(samples + got, 0, (wanted - got) * sizeof(int16_t));
+    // running out at the end isn't an underrun
+    if (!out->finishing)
+    {
+      out->underruns++;
+      out->underrun_frames += (wanted - got) / 2;
+    }
   }
-  
-  /*
-  if (SDL_GetQueuedAudioSize(dev_id) < 44100) SDL_PauseAudioDevice(dev_id, 1);
-  else SDL_PauseAudioDevice(dev_id, 0);
-  */
-  
-  SDL_Event ev;
+}
 
-  while (SDL_GetQueuedAudioSize(dev_id) > 44100 * 16)
+void SDLAudioOut::write(const int16_t *data, uint32_t count)
+{
+  while (!err)
   {
+    uint32_t n = ring.write(data, count);
+    data += n;
+    count -= n;
+    if (count == 0) break;
+
+    // full, so play what's there if it isn't playing already
+    if (!started)
+    {
+      SDL_PauseAudioDevice(dev_id, 0);
+      started = true;
+    }
     SDL_Delay(1);
-    while (SDL_PollEvent(&ev))
+  }
+}
+
+bool SDLAudioOut::pollEvents()
+{
+  SDL_Event ev;
+  while (SDL_PollEvent(&ev))
+  {
+    if (ev.type == SDL_QUIT)
     {
-      if (ev.type == SDL_QUIT)
-      {
-        printf("Received Ctrl+C event; quitting soon\n");
-        return false;
-      }
+      printf("Received Ctrl+C event; quitting soon\n");
+      err = true;
     }
   }
-  return true;
+  return !err;
+}
+
+void SDLAudioOut::finish()
+{
+  if (err) return;
+  finishing = true;
+  if (!started)
+  {
+    SDL_PauseAudioDevice(dev_id, 0);
+    started = true;
+  }
+  while (!err && ring.size() > 0)
+  {
+    SDL_Delay(1);
+  }
+  // and what the device already took
+  SDL_Delay(audio_spec.samples * 1000 / audio_spec.freq + 1);
 }
 
 void SDLAudioOut::tick(stk::StkFloat val)
@@ -73,21 +107,21 @@ void SDLAudioOut::tick(stk::StkFloat val)
   pt[0] = (int16_t)(clipTest(val) * 32767);
   pt[1] = pt[0];
 
-  if (!writeData(dev_id, pt, 4)) err = true;
+  write(pt, 2);
 }
 
 void SDLAudioOut::tick(const stk::StkFrames &data)
 {
   if (err) return;
   if (data.channels() != 2) return;
-  int16_t buf[data.size()];
+  if (convert.size() < data.size()) convert.resize(data.size());
   for (uint32_t i = 0; i < data.frames(); i++)
   {
     stk::StkFloat left  = data(i, 0) * volume;
     stk::StkFloat right = data(i, 1) * volume;
-    buf[i*2]     = (int16_t)(clipTest(left)  * 32767);
-    buf[i*2 + 1] = (int16_t)(clipTest(right) * 32767);
+    convert[i*2]     = (int16_t)(clipTest(left)  * 32767);
+    convert[i*2 + 1] = (int16_t)(clipTest(right) * 32767);
   }
 
-  if (!writeData(dev_id, buf, data.size() * 2)) err = true;
-}
\ No newline at end of file
+  write(convert.data(), data.size());
+}
@@ -1,33 +1,69 @@
 #ifndef SYNTH_AUDIO_AUDIO_OUT_H
 #define SYNTH_AUDIO_AUDIO_OUT_H
 
+#include "ring_buffer.h"
+
 #include <SDL2/SDL_audio.h>
 #include <stk/WvOut.h>
 #include <stk/Stk.h>
 #include <stdint.h>
+#include <vector>
+#include <atomic>
+
+/*
+  Live output through SDL. Samples written with tick() go into a ring
+  buffer holding about `latency` frames, which SDL's audio callback empties
+  as the device needs them; tick() waits while the ring is full. Audio
+  starts once the ring has filled the first time. If the callback finds the
+  ring short it plays silence for the rest and counts an underrun.
 
+  tick() is meant to be called from a render thread of its own, while
+  another thread calls pollEvents().
+*/
 class SDLAudioOut : public stk::WvOut
 {
 private:
   SDL_AudioSpec audio_spec;
-  bool err = false;
+  std::atomic<bool> err{false};
   double volume = 1;
   bool started = false;
-  
+  std::atomic<bool> finishing{false};
+
   int dev_id = -1;
+  SampleRing ring;
+  // tick()'s output converted to 16 bits
+  std::vector<int16_t> convert;
+
+  std::atomic<uint64_t> underruns{0};
+  std::atomic<uint64_t> underrun_frames{0};
+
+  void write(const int16_t *data, uint32_t count);
+  static void callback(void *userdata, Uint8 *stream, int len);
+
 public:
-  SDLAudioOut(float samplerate, uint32_t bufsize=1024);
+  // latency is in frames; bufsize is the frames SDL asks for at a time
+  SDLAudioOut(float samplerate, uint32_t latency=4096, uint32_t bufsize=1024);
   ~SDLAudioOut();
 
   void tick(const stk::StkFloat val) override;
   void tick(const stk::StkFrames &data) override;
 
+  // handle SDL events; false once asked to quit, which makes the output bad
+  bool pollEvents();
+  // wait for everything written to be played
+  void finish();
+
   bool bad() { return err; }
 
   void setVolume(double volume) { this->volume = volume; }
   double getVolume() { return volume; }
 
-  uint32_t getQueueSize() { return SDL_GetQueuedAudioSize(dev_id); }
+  // bytes waiting to be played
+  uint32_t getQueueSize() { return ring.size() * sizeof(int16_t); }
+  // times the device asked for more than was ready, and the frames of
+  // silence played instead
+  uint64_t getUnderruns() { return underruns; }
+  uint64_t getUnderrunFrames() { return underrun_frames; }
 };
 
 #endif // SYNTH_AUDIO_AUDIO_OUT_H
@@ -0,0 +1,135 @@
+#include "loop_wav_out.h"
+
+#include <fstream>
+#include <algorithm>
+
+// RIFF fields are little endian whatever the host is
+static void put16(std::vector<uint8_t> &out, uint16_t v)
+{
+  out.push_back(v & 0xFF);
+  out.push_back(v >> 8);
+}
+
+static void put32(std::vector<uint8_t> &out, uint32_t v)
+{
+  put16(out, v & 0xFFFF);
+  put16(out, v >> 16);
+}
+
+static void putTag(std::vector<uint8_t> &out, const char *tag)
+{
+  out.insert(out.end(), tag, tag + 4);
+}
+
+LoopWavOut::LoopWavOut(std::string filename, uint32_t samplerate)
+  : stk::WvOut(), filename(filename), samplerate(samplerate)
+{
+
+}
+
+void LoopWavOut::tick(const stk::StkFloat val)
+{
+  stk::StkFloat v = val;
+  int16_t s = (int16_t)(clipTest(v) * 32767);
+  data.push_back(s);
+  data.push_back(s);
+  frameCounter_++;
+}
+
+void LoopWavOut::tick(const stk::StkFrames &frames)
+{
+  if (frames.channels() != 2) return;
+  for (uint32_t i = 0; i < frames.frames(); i++)
+  {
+    stk::StkFloat left  = frames(i, 0);
+    stk::StkFloat right = frames(i, 1);
+    data.push_back((int16_t)(clipTest(left)  * 32767));
+    data.push_back((int16_t)(clipTest(right) * 32767));
+  }
+  frameCounter_ += frames.frames();
+}
+
+void LoopWavOut::truncate(uint64_t frames)
+{
+  if (frames < getFrames()) data.resize(frames * 2);
+}
+
+uint64_t LoopWavOut::matchesFrom(uint64_t a, uint64_t b, uint64_t count)
+{
+  if (std::max(a, b) + count > getFrames()) return count;
+  uint64_t k = count;
+  while (k > 0 && data[(a + k - 1) * 2] == data[(b + k - 1) * 2] &&
+         data[(a + k - 1) * 2 + 1] == data[(b + k - 1) * 2 + 1])
+  {
+    k--;
+  }
+  return k;
+}
+
+void LoopWavOut::setLoop(uint64_t start, uint64_t end)
+{
+  looped = start < end;
+  loop_start = start;
+  loop_end = end;
+}
+
+bool LoopWavOut::close()
+{
+  std::vector<uint8_t> head;
+  uint32_t data_size = data.size() * 2;
+  uint32_t smpl_size = looped ? 36 + 24 : 0;
+
+  putTag(head, "RIFF");
+  put32(head, 4 + (8 + 16) + (looped ? 8 + smpl_size : 0) + 8 + data_size);
+  putTag(head, "WAVE");
+
+  putTag(head, "fmt ");
+  put32(head, 16);
+  put16(head, 1); // PCM
+  put16(head, 2);
+  put32(head, samplerate);
+  put32(head, samplerate * 4);
+  put16(head, 4);
+  put16(head, 16);
+
+  if (looped)
+  {
+    putTag(head, "smpl");
+    put32(head, smpl_size);
+    put32(head, 0); // manufacturer
+    put32(head, 0); // product
+    put32(head, 1000000000 / samplerate); // sample period, ns
+    put32(head, 60); // unity note
+    put32(head, 0); // pitch fraction
+    put32(head, 0); // SMPTE format
+    put32(head, 0); // SMPTE offset
+    put32(head, 1); // loops
+    put32(head, 0); // sampler data
+    put32(head, 0); // cue point ID
+    put32(head, 0); // forward loop
+    put32(head, (uint32_t)loop_start);
+    put32(head, (uint32_t)(loop_end - 1)); // last frame played, inclusive
+    put32(head, 0); // fraction
+    put32(head, 0); // loop forever
+  }
+
+  putTag(head, "data");
+  put32(head, data_size);
+
+  std::ofstream f(filename, std::ios::binary);
+  if (!f)
+  {
+    printf("WARN: Unable to write %s\n", filename.c_str());
+    return false;
+  }
+  f.write((const char *)head.data(), head.size());
+  // samples go out little endian too
+  std::vector<uint8_t> buf;
+  buf.reserve(data_size);
+  for (int16_t s : data)
+  {
+    put16(buf, (uint16_t)s);
+  }
+  f.write((const char *)buf.data(), buf.size());
+  return f.good();
+}
@@ -0,0 +1,44 @@
+#ifndef SYNTH_AUDIO_LOOP_WAV_OUT_H
+#define SYNTH_AUDIO_LOOP_WAV_OUT_H
+
+#include <stk/WvOut.h>
+#include <stk/Stk.h>
+#include <stdint.h>
+#include <vector>
+#include <string>
+
+/*
+  16-bit stereo WAV writer that can mark a loop in a RIFF `smpl` chunk,
+  which is where samplers and game audio tools look for loop points. The
+  audio is kept in memory until close(), so the length and loop can still
+  be decided after it has been written.
+*/
+class LoopWavOut : public stk::WvOut
+{
+private:
+  std::string filename;
+  uint32_t samplerate;
+  std::vector<int16_t> data; // interleaved
+  bool looped = false;
+  uint64_t loop_start = 0;
+  uint64_t loop_end = 0;
+
+public:
+  LoopWavOut(std::string filename, uint32_t samplerate);
+
+  void tick(const stk::StkFloat val) override;
+  void tick(const stk::StkFrames &frames) override;
+
+  uint64_t getFrames() { return data.size() / 2; }
+  // drop everything after the first `frames` frames
+  void truncate(uint64_t frames);
+  // how far into the `count` frames from a and from b they start being the
+  // same through to the end; count if the last ones differ
+  uint64_t matchesFrom(uint64_t a, uint64_t b, uint64_t count);
+  // loop from frame start up to, not including, frame end
+  void setLoop(uint64_t start, uint64_t end);
+  // write the file out; false if it can't be written
+  bool close();
+};
+
+#endif // SYNTH_AUDIO_LOOP_WAV_OUT_H
@@ -0,0 +1,43 @@
+#include "ring_buffer.h"
+
+#include <algorithm>
+#include <string.h>
+
+SampleRing::SampleRing(uint32_t capacity)
+{
+  uint32_t size = 1;
+  while (size < capacity) size <<= 1;
+  buf.resize(size);
+  mask = size - 1;
+}
+
+uint32_t SampleRing::write(const int16_t *data, uint32_t count)
+{
+  uint64_t h = head.load(std::memory_order_relaxed);
+  uint64_t t = tail.load(std::memory_order_acquire);
+  count = std::min<uint64_t>(count, buf.size() - (h - t));
+
+  // in up to two pieces, if it wraps round the end
+  uint32_t at = h & mask;
+  uint32_t first = std::min<uint32_t>(count, buf.size() - at);
+  memcpy(&buf[at], data, first * sizeof(int16_t));
+  memcpy(&buf[0], data + first, (count - first) * sizeof(int16_t));
+
+  head.store(h + count, std::memory_order_release);
+  return count;
+}
+
+uint32_t SampleRing::read(int16_t *data, uint32_t count)
+{
+  uint64_t t = tail.load(std::memory_order_relaxed);
+  uint64_t h = head.load(std::memory_order_acquire);
+  count = std::min<uint64_t>(count, h - t);
+
+  uint32_t at = t & mask;
+  uint32_t first = std::min<uint32_t>(count, buf.size() - at);
+  memcpy(data, &buf[at], first * sizeof(int16_t));
+  memcpy(data + first, &buf[0], (count - first) * sizeof(int16_t));
+
+  tail.store(t + count, std::memory_order_release);
+  return count;
+}
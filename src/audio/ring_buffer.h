@@ -0,0 +1,39 @@
+#ifndef SYNTH_AUDIO_RING_BUFFER_H
+#define SYNTH_AUDIO_RING_BUFFER_H
+
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+
+/*
+  Fixed-size ring of 16-bit samples for one writing thread and one reading
+  thread. Neither side locks or allocates: each only moves its own position
+  forward, after copying, so the other side sees whole samples.
+*/
+class SampleRing
+{
+private:
+  std::vector<int16_t> buf;
+  uint32_t mask;
+  // total samples ever written and read
+  std::atomic<uint64_t> head{0};
+  std::atomic<uint64_t> tail{0};
+
+public:
+  // capacity is rounded up to a power of 2
+  SampleRing(uint32_t capacity);
+
+  SampleRing(const SampleRing &) = delete;
+  SampleRing &operator=(const SampleRing &) = delete;
+
+  // writer side. copies in as much of data as fits, returning how much
+  uint32_t write(const int16_t *data, uint32_t count);
+  // reader side. copies out up to count samples, returning how many
+  uint32_t read(int16_t *data, uint32_t count);
+
+  // samples waiting to be read; either side may ask
+  uint32_t size() { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+  uint32_t capacity() { return buf.size(); }
+};
+
+#endif // SYNTH_AUDIO_RING_BUFFER_H
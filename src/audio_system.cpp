@@ -1,42 +1,137 @@
 #include "audio_system.h"
 
-AudioSystem::AudioSystem(std::string aaf_path, std::string waves_path)
-  : waves_path(waves_path), aaf(waves_path)
+#include <algorithm>
+
+AudioSystem::AudioSystem(std::string aaf_path, std::string waves_path, uint32_t polyphony)
+  : waves_path(waves_path), aaf(waves_path), polyphony(polyphony)
 {
   this->aaf.load(aaf_path);
+  initVoices();
 }
 
-Note *AudioSystem::getNewNote()
+AudioSystem::AudioSystem(AudioSystem &shared, uint32_t polyphony)
+  : aaf(shared.waves_path), polyphony(polyphony), waves_path(shared.waves_path),
+    shared(&shared)
+{
+  initVoices();
+}
+
+void AudioSystem::initVoices()
 {
-  for (std::unique_ptr<Note> &n : notes)
+  notes.reset(new Note[polyphony]);
+  for (uint32_t i = polyphony; i > 0; i--)
   {
-    if (n->isFinished())
+    notes[i - 1].pool_next = free_head;
+    free_head = &notes[i - 1];
+  }
+}
+
+void AudioSystem::linkBusy(Note *note)
+{
+  note->pool_prev = busy_tail;
+  note->pool_next = nullptr;
+  if (busy_tail != nullptr) busy_tail->pool_next = note;
+  else busy_head = note;
+  busy_tail = note;
+  note->pool_busy = true;
+}
+
+void AudioSystem::unlinkBusy(Note *note)
+{
+  if (note->pool_prev != nullptr) note->pool_prev->pool_next = note->pool_next;
+  else busy_head = note->pool_next;
+  if (note->pool_next != nullptr) note->pool_next->pool_prev = note->pool_prev;
+  else busy_tail = note->pool_prev;
+  note->pool_prev = nullptr;
+  note->pool_next = nullptr;
+  note->pool_busy = false;
+}
+
+Note *AudioSystem::pickVictim()
+{
+  // the scans are bounded by the polyphony
+  if (steal_policy == STEAL_QUIETEST)
+  {
+    Note *quietest = nullptr;
+    for (Note *n = busy_head; n != nullptr; n = n->pool_next)
     {
-      n->reset(); // mark as in-use again
-      return n.get();
+      // notes that haven't rendered yet have no level to go by
+      if (n->block_gain == 0) continue;
+      if (quietest == nullptr || n->getLevel() < quietest->getLevel()) quietest = n;
     }
+    if (quietest != nullptr) return quietest;
+  }
+  else if (steal_policy == STEAL_RELEASED)
+  {
+    for (Note *n = busy_head; n != nullptr; n = n->pool_next)
+    {
+      if (n->env.isReleased()) return n;
+    }
+  }
+  return busy_head;
+}
+
+Note *AudioSystem::getNewNote()
+{
+  Note *note = free_head;
+  if (note != nullptr)
+  {
+    free_head = note->pool_next;
+    busy_count++;
   }
-  notes.push_back(std::make_unique<Note>());
-  return notes.back().get();
+  else
+  {
+    note = pickVictim();
+    if (note == nullptr) return nullptr;
+    note->stopNow();
+    unlinkBusy(note);
+    note->serial++;
+    stolen_count++;
+  }
+
+  linkBusy(note);
+  note->reset(); // mark as in-use again
+  return note;
+}
+
+void AudioSystem::freeNote(Note *note)
+{
+  if (note == nullptr || !note->pool_busy) return;
+  note->stopNow();
+  unlinkBusy(note);
+  note->serial++;
+  note->pool_next = free_head;
+  free_head = note;
+  busy_count--;
 }
 
 IBNK *AudioSystem::getBank(uint32_t id)
 {
-  if (banks.count(id) == 0)
+  if (shared != nullptr) return shared->getBank(id);
+  // find() only reads the map; see the constructor for views
+  std::unordered_map<uint32_t, std::unique_ptr<IBNK>>::iterator it = banks.find(id);
+  if (it == banks.end())
   {
-    banks[id] = std::make_unique<IBNK>(aaf.loadBank(id));
+    it = banks.emplace(id, std::make_unique<IBNK>(aaf.loadBank(id))).first;
+    if (it->second->isLoaded())
+    {
+      for (float rate : sample_rates) buildCurves(it->second.get(), rate);
+    }
   }
-  if (!banks[id]->isLoaded()) return nullptr;
-  return banks[id].get();
+  if (!it->second->isLoaded()) return nullptr;
+  return it->second.get();
 }
 
 Wavesystem *AudioSystem::getWavesystem(uint32_t id)
 {
-  if (wavesystems.count(id) == 0)
+  if (shared != nullptr) return shared->getWavesystem(id);
+  std::unordered_map<uint32_t, std::unique_ptr<Wavesystem>>::iterator it = wavesystems.find(id);
+  if (it == wavesystems.end())
   {
-    wavesystems[id] = std::move(std::make_unique<Wavesystem>(aaf.loadWavesystem(id)));
+    it = wavesystems.emplace(id, std::make_unique<Wavesystem>(aaf.loadWavesystem(id))).first;
+    if (mip_levels > 0) it->second->buildLevels(mip_levels);
   }
-  return wavesystems[id].get();
+  return it->second.get();
 }
 
 Wavesystem *AudioSystem::getWsysFor(IBNK *bank)
@@ -44,29 +139,58 @@ Wavesystem *AudioSystem::getWsysFor(IBNK *bank)
   return getWavesystem(bank->getWavesystemID());
 }
 
-stk::StkFloat AudioSystem::tickAllNotes()
+void AudioSystem::setMipLevels(uint32_t levels)
 {
-  stk::StkFloat total = 0;
-  for (std::unique_ptr<Note> &note : notes)
+  if (shared != nullptr)
   {
-    if (note->isPlaying())
-    {
-      total += note->tick();
-    }
+    shared->setMipLevels(levels);
+    return;
   }
+  mip_levels = levels;
+  for (std::pair<const uint32_t, std::unique_ptr<Wavesystem>> &entry : wavesystems)
+  {
+    entry.second->buildLevels(levels);
+  }
+}
 
-  return total;
+void AudioSystem::addSampleRate(float rate)
+{
+  if (shared != nullptr)
+  {
+    shared->addSampleRate(rate);
+    return;
+  }
+  if (std::find(sample_rates.begin(), sample_rates.end(), rate) != sample_rates.end()) return;
+  sample_rates.push_back(rate);
+  for (std::pair<const uint32_t, std::unique_ptr<IBNK>> &entry : banks)
+  {
+    if (entry.second->isLoaded()) buildCurves(entry.second.get(), rate);
+  }
+}
+
+void AudioSystem::buildCurves(IBNK *bank, float rate)
+{
+  for (uint32_t i = 0; i < IBNK::NUM_INSTRUMENTS; i++)
+  {
+    BankInstrument *inst = bank->instruments[i].get();
+    if (inst != nullptr) Envelope::getCurves(&inst->osci, rate);
+  }
 }
 
-uint32_t AudioSystem::getNumActiveNotes()
+stk::StkFloat AudioSystem::tickAllNotes()
 {
-  uint32_t total = 0;
-  for (std::unique_ptr<Note> &note : notes)
+  stk::StkFloat total = 0;
+  Note *note = busy_head;
+  while (note != nullptr)
   {
+    Note *next = note->pool_next;
     if (note->isPlaying())
     {
-      total++;
+      total += note->tick();
     }
+    if (note->isFinished()) freeNote(note);
+    note = next;
   }
+
   return total;
 }
@@ -19,20 +19,76 @@ private:
 
   std::unordered_map<uint32_t, std::unique_ptr<IBNK>> banks;
   std::unordered_map<uint32_t, std::unique_ptr<Wavesystem>> wavesystems;
-  std::vector<std::unique_ptr<Note>> notes;
+
+  // fixed set of voices, allocated up front
+  std::unique_ptr<Note[]> notes;
+  uint32_t polyphony;
+  Note *free_head = nullptr;
+  // busy notes, oldest first
+  Note *busy_head = nullptr;
+  Note *busy_tail = nullptr;
+  uint32_t busy_count = 0;
+  uint64_t stolen_count = 0;
 
   std::string waves_path;
+  uint32_t mip_levels = 0;
+  // output rates to build every loaded bank's envelope curves for
+  std::vector<float> sample_rates;
+  // banks and wave systems come from here instead, if set
+  AudioSystem *shared = nullptr;
+
+  void initVoices();
+  void buildCurves(IBNK *bank, float rate);
+  void linkBusy(Note *note);
+  void unlinkBusy(Note *note);
+  Note *pickVictim();
 
 public:
-  AudioSystem(std::string aaf_path, std::string waves_path);
+  // what getNewNote() takes when every voice is busy
+  enum StealPolicy
+  {
+    STEAL_OLDEST,
+    STEAL_QUIETEST, // lowest level as of the last block
+    STEAL_RELEASED  // oldest note that has been released, else the oldest
+  };
+
+  static const uint32_t DEFAULT_POLYPHONY = 256;
+
+  AudioSystem(std::string aaf_path, std::string waves_path,
+              uint32_t polyphony = DEFAULT_POLYPHONY);
+  // a voice pool of its own over the banks and wave systems of `shared`,
+  // which has to outlive it. looking up something already loaded doesn't
+  // change anything, so several of these can play on different threads once
+  // everything they need has been loaded through `shared`
+  AudioSystem(AudioSystem &shared, uint32_t polyphony = DEFAULT_POLYPHONY);
+
+  StealPolicy steal_policy = STEAL_RELEASED;
 
+  // a note from the pool, reset and ready for SampleInstr::createNote(). if
+  // every voice is busy, one is stopped and taken according to
+  // steal_policy; references to it held elsewhere go stale (see NoteRef).
+  // nullptr only if the polyphony is 0
   Note *getNewNote();
+  // give a note back to the pool once it's done with, stopping it if needed
+  void freeNote(Note *note);
   IBNK *getBank(uint32_t id);
   Wavesystem *getWavesystem(uint32_t id);
   Wavesystem *getWsysFor(IBNK *bank);
+  // build this many band-limited levels of every wave, for playing at high
+  // pitches without aliasing. 0 (the default) turns them off
+  void setMipLevels(uint32_t levels);
+  // build the envelope curves of every instrument for notes played at
+  // `rate`, now for the banks already loaded and as the others load, so
+  // starting a note doesn't have to (see Envelope::getCurves()). adding a
+  // rate that is already there changes nothing
+  void addSampleRate(float rate);
 
+  // tick every busy note, giving back the ones that finish
   stk::StkFloat tickAllNotes();
-  uint32_t getNumActiveNotes();
+  // notes handed out and not given back yet
+  uint32_t getNumActiveNotes() { return busy_count; }
+  uint32_t getPolyphony() { return polyphony; }
+  uint64_t getNumStolen() { return stolen_count; }
 };
 
 #endif // SYNTH_AUDIO_SYSTEM_H
\ No newline at end of file
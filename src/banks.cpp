@@ -1,9 +1,11 @@
 #include "banks.h"
 #include "util.h"
+#include "common/wave.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <fstream>
+#include <algorithm>
 
 #include <stk/FileWvOut.h>
 
@@ -15,6 +17,7 @@ Wavesystem::Wavesystem(void) { }
 static void decode_adpcm4(stk::StkFrames &data, std::ifstream &f, uint32_t size);
 static void decode_pcm8(stk::StkFrames &data, std::ifstream &f, uint32_t size);
 static void decode_pcm16(stk::StkFrames &data, std::ifstream &f, uint32_t size);
+static void add_guard_samples(Wave *wave, stk::StkFrames &raw);
 
 bool Wavesystem::getID(std::istream &f, uint32_t *id)
 {
@@ -205,17 +208,24 @@ bool Wavesystem::load(std::istream &f, std::string waves_path)
     std::string infile = waves_path + "/" + std::string(wave->aw_filename);
 
     printf("Decoding %s:%08x-%08x\n", wave->aw_filename, wave->wavedata_offset, wave->wavedata_offset + wave->wavedata_size);
-    wave->data.resize(wave->sample_count, 1, 0);
+    if (wave->loop && wave->loop_end <= wave->loop_start + 1)
+    {
+      printf("WARN: Wave %u has an empty loop (%u-%u); playing it once\n",
+             waveid.wave_id, wave->loop_start, wave->loop_end);
+      wave->loop = false;
+    }
+    stk::StkFrames raw(wave->sample_count, 1);
 
     std::ifstream in_data(infile, std::ios::binary);
     in_data.seekg(wave->wavedata_offset);
-    if (wave->format == 0) decode_adpcm4(wave->data, in_data, wave->wavedata_size);
-    else if (wave->format == 2) decode_pcm8(wave->data, in_data, wave->wavedata_size);
-    else if (wave->format == 3) decode_pcm16(wave->data, in_data, wave->wavedata_size);
+    if (wave->format == 0) decode_adpcm4(raw, in_data, wave->wavedata_size);
+    else if (wave->format == 2) decode_pcm8(raw, in_data, wave->wavedata_size);
+    else if (wave->format == 3) decode_pcm16(raw, in_data, wave->wavedata_size);
     else
     {
       printf("Unknown wave format %d\n", wave->format);
     }
+    add_guard_samples(wave.get(), raw);
     
 
   /*
@@ -229,6 +239,53 @@ bool Wavesystem::load(std::istream &f, std::string waves_path)
   return true;
 }
 
+void Wavesystem::buildLevels(uint32_t count)
+{
+  for (std::pair<const WaveEntry, std::unique_ptr<Wave>> &entry : waves)
+  {
+    entry.second->buildLevels(count);
+  }
+}
+
+void Wave::buildLevels(uint32_t count)
+{
+  levels.clear();
+  if (count == 0 || data.size() == 0) return;
+
+  const uint32_t g = GUARD_SAMPLES;
+  uint32_t end = loop ? loop_end - 1 : std::max(loop_end, sample_count);
+  // run the loop on past the end, far enough that every level still has
+  // its guard samples after the filter's reach is taken off
+  uint32_t ext = (g + 32) << count;
+
+  Common::Wavedata wd(end + ext, (uint32_t)sample_rate);
+  for (uint32_t i = 0; i < end; i++)
+  {
+    wd[i] = data[g + i];
+  }
+  if (loop)
+  {
+    uint32_t len = getLoopLength();
+    for (uint32_t i = end; i < end + ext; i++)
+    {
+      wd[i] = wd[loop_start + (i - end) % len];
+    }
+  }
+  wd.setLoopInfo(loop, loop_start, loop_end);
+
+  for (uint32_t n = 0; n < count; n++)
+  {
+    wd = wd.decimate();
+    stk::StkFrames level;
+    level.resize(g + wd.getSize(), 1, 0);
+    for (uint32_t i = 0; i < wd.getSize(); i++)
+    {
+      level[g + i] = wd[i];
+    }
+    levels.push_back(level);
+  }
+}
+
 static const int16_t adpcm_coeffs[32] =
 {
       0,     0,
@@ -356,6 +413,31 @@ static void decode_pcm16(stk::StkFrames &data, std::ifstream &f, uint32_t size)
   }
 }
 
+static void add_guard_samples(Wave *wave, stk::StkFrames &raw)
+{
+  const uint32_t g = Wave::GUARD_SAMPLES;
+  // where the guard samples after the wave begin
+  uint32_t end = wave->loop ? wave->loop_end - 1 : std::max(wave->loop_end, wave->sample_count);
+
+  // silence before the start and after a one-shot wave
+  wave->data.resize(g + std::max(wave->sample_count, end) + g, 1, 0);
+  for (uint32_t i = 0; i < raw.size(); i++)
+  {
+    wave->data[g + i] = raw[i];
+  }
+
+  if (wave->loop)
+  {
+    // continue into the loop, so reads just past the end see what a wrapped
+    // read would
+    uint32_t len = wave->getLoopLength();
+    for (uint32_t i = 0; i < g; i++)
+    {
+      wave->data[g + end + i] = wave->data[g + wave->loop_start + i % len];
+    }
+  }
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // IBNK decoding
 
@@ -36,7 +36,68 @@ struct Wave
   uint16_t aw_id;
   uint16_t wave_id;
 
+  // decoded samples with GUARD_SAMPLES on either side, so interpolators can
+  // read around the position without bounds checks. the ones before are
+  // silence; the ones after are a copy of the loop start for looped waves
+  // (the sample at loop_end - 1 doubles as loop_start), silence otherwise
   stk::StkFrames data;
+
+  static const uint32_t GUARD_SAMPLES = 8;
+
+  // band-limited copies at 1/2, 1/4, ... of the sample rate, padded the same
+  // way as data. empty unless buildLevels() was called
+  std::vector<stk::StkFrames> levels;
+
+  // first decoded sample of a level (0 is the original data)
+  const stk::StkFloat *samples(uint32_t level = 0)
+  {
+    return level == 0 ? &data[GUARD_SAMPLES] : &levels[level - 1][GUARD_SAMPLES];
+  }
+
+  void buildLevels(uint32_t count);
+  // level to read from when stepping `step` samples per output sample.
+  // level n is read at phase >> n
+  uint32_t pickLevel(double step)
+  {
+    // each level passes 90% of its bandwidth, so this keeps aliasing to the
+    // top few percent of the spectrum
+    const double max_step = 1.125;
+    uint32_t level = 0;
+    while (level < levels.size() && step > max_step)
+    {
+      step *= 0.5;
+      level++;
+    }
+    return level;
+  }
+
+  // playback positions are 32.32 fixed point sample offsets
+  static const uint32_t PHASE_BITS = 32;
+  static const uint64_t PHASE_ONE = 1ULL << PHASE_BITS;
+
+  // length of the loop as played; 0 if the wave doesn't loop
+  uint32_t getLoopLength()
+  {
+    return loop ? loop_end - loop_start - 1 : 0;
+  }
+
+  // move phase back into the loop if it has reached the end, then return how
+  // many of the next `max` steps of inc stay short of the end
+  uint32_t wrapSpan(uint64_t &phase, uint64_t inc, uint32_t max)
+  {
+    if (!loop) return max;
+    uint64_t wrap_at = (uint64_t)(loop_end - 1) << PHASE_BITS;
+    if (phase >= wrap_at)
+    {
+      uint64_t start = (uint64_t)loop_start << PHASE_BITS;
+      uint64_t len = (uint64_t)getLoopLength() << PHASE_BITS;
+      phase -= len;
+      if (phase >= wrap_at) phase = (phase - start) % len + start;
+    }
+    if (inc == 0) return max;
+    uint64_t left = (wrap_at - phase + inc - 1) / inc;
+    return left < max ? (uint32_t)left : max;
+  }
 };
 
 struct WaveEntry
@@ -65,6 +126,8 @@ public:
   Wave *getWave(uint16_t aw_id, uint16_t wave_id);
   uint32_t getNumWaves();
   uint32_t getWsysID() { return wsys_id; }
+  // see Wave::buildLevels()
+  void buildLevels(uint32_t count);
 
   static bool getID(std::istream &f, uint32_t *id);
 };
@@ -121,6 +184,35 @@ struct Envp
   int16_t value;
 };
 
+// an envelope rendered at one output sample rate. sample i of the curve is
+// level[i] + carry[i] * c, where c is the value the envelope had when it
+// entered the curve (the release start) or jumped back to loop_start; carry
+// is zero outside the first segment after either
+struct EnvCurve
+{
+  enum
+  {
+    END_STOP,
+    END_HOLD,
+    END_LOOP
+  };
+
+  std::vector<float> level;
+  std::vector<float> carry;
+  uint8_t end = END_STOP;
+  uint32_t loop_start = 0;
+  // value held after the last sample, for END_HOLD
+  float hold_level = 0;
+  float hold_carry = 0;
+};
+
+struct EnvCurves
+{
+  float rate;
+  EnvCurve attack;
+  EnvCurve release;
+};
+
 struct Osci
 {
   uint8_t mode;
@@ -129,6 +221,10 @@ struct Osci
   std::vector<Envp> relEnv;
   float width;
   float vertex;
+
+  // atkEnv and relEnv rendered for each output rate in use; see
+  // Envelope::getCurves()
+  std::vector<std::unique_ptr<EnvCurves>> curves;
 };
 
 struct BankInstrument
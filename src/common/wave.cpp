@@ -0,0 +1,135 @@
+#include "wave.h"
+
+#include <cmath>
+
+namespace Common
+{
+
+// half-band low-pass used by decimate(). passes up to 90% of the new
+// Nyquist frequency; 2 * HALFBAND_TAPS + 1 taps.
+static const int HALFBAND_TAPS = 16;
+static const double HALFBAND_CUTOFF = 0.45 * 0.5; // fraction of the input rate
+
+static std::vector<double> buildHalfband()
+{
+  std::vector<double> h(2 * HALFBAND_TAPS + 1);
+  double sum = 0;
+  for (int i = -HALFBAND_TAPS; i <= HALFBAND_TAPS; i++)
+  {
+    double x = 2 * HALFBAND_CUTOFF * i;
+    double s = (i == 0) ? 1 : std::sin(M_PI * x) / (M_PI * x);
+    double w = 0.42 + 0.5 * std::cos(M_PI * i / (HALFBAND_TAPS + 1))
+                    + 0.08 * std::cos(2 * M_PI * i / (HALFBAND_TAPS + 1));
+    h[i + HALFBAND_TAPS] = s * w;
+    sum += s * w;
+  }
+  for (double &c : h) c /= sum;
+  return h;
+}
+
+Wavedata::Wavedata(size_t size, uint32_t samplerate)
+  : data(size, 0.0f), samplerate(samplerate)
+{
+}
+
+Wavedata::Wavedata(float *data, size_t size, uint32_t samplerate)
+  : data(data, data + size), samplerate(samplerate)
+{
+}
+
+Wavedata::Wavedata(uint16_t *data, size_t size, uint32_t samplerate)
+  : samplerate(samplerate)
+{
+  put(data, size);
+}
+
+void Wavedata::setLoopInfo(bool loop, size_t start, size_t end)
+{
+  this->looped = loop;
+  this->loop_start = start;
+  this->loop_end = end;
+}
+
+void Wavedata::put(float pt)
+{
+  data.push_back(pt);
+}
+
+void Wavedata::put(float *data, size_t size)
+{
+  this->data.insert(this->data.end(), data, data + size);
+}
+
+void Wavedata::put(uint16_t *data, size_t size)
+{
+  // 16-bit signed PCM
+  this->data.reserve(this->data.size() + size);
+  for (size_t i = 0; i < size; i++)
+  {
+    this->data.push_back((int16_t)data[i] / 32768.0f);
+  }
+}
+
+void Wavedata::resize(size_t size)
+{
+  data.resize(size, 0.0f);
+}
+
+void Wavedata::setSamplerate(uint32_t samplerate)
+{
+  this->samplerate = samplerate;
+}
+
+float &Wavedata::operator[](size_t pos)
+{
+  return data[pos];
+}
+
+float Wavedata::operator[](size_t pos) const
+{
+  return data[pos];
+}
+
+float Wavedata::get(float pos)
+{
+  if (pos < 0) return 0;
+  if (looped && loop_end > loop_start && pos >= loop_end)
+  {
+    pos = std::fmod(pos - loop_start, (float)(loop_end - loop_start)) + loop_start;
+  }
+
+  size_t i = (size_t)pos;
+  if (i >= data.size()) return 0;
+  float next = (i + 1 < data.size()) ? data[i + 1] : 0.0f;
+  float off = pos - i;
+  return (next - data[i]) * off + data[i];
+}
+
+float *Wavedata::getData()
+{
+  return data.data();
+}
+
+Wavedata Wavedata::decimate() const
+{
+  static const std::vector<double> h = buildHalfband();
+
+  size_t size = data.size();
+  Wavedata out((size + 1) / 2, samplerate / 2);
+  for (size_t j = 0; j < out.data.size(); j++)
+  {
+    // samples outside the data count as silence
+    double v = 0;
+    for (int k = -HALFBAND_TAPS; k <= HALFBAND_TAPS; k++)
+    {
+      long i = (long)(2 * j) + k;
+      if (i < 0 || i >= (long)size) continue;
+      v += h[k + HALFBAND_TAPS] * data[i];
+    }
+    out.data[j] = (float)v;
+  }
+  out.setLoopInfo(looped, loop_start / 2, loop_end / 2);
+  return out;
+}
+
+} // namespace Common
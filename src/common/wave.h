@@ -27,6 +27,9 @@ public:
   
   uint32_t getSize() { return data.size(); }
   uint32_t getSamplerate() { return samplerate; }
+  bool isLooped() { return looped; }
+  size_t getLoopStart() { return loop_start; }
+  size_t getLoopEnd() { return loop_end; }
 
   void put(float pt);
   void put(float *data, size_t size);
@@ -36,10 +39,13 @@ public:
   void setSamplerate(uint32_t samplerate);
 
   float &operator[](size_t pos);
-  const float operator[](size_t pos) const;
+  float operator[](size_t pos) const;
 
   float get(float pos);
   float *getData(); // this pointer is invalidated if the size changes
+
+  // low-pass filtered to half the bandwidth and every other sample dropped
+  Wavedata decimate() const;
 };
 
 struct Wave
@@ -1,33 +1,160 @@
 #include <string>
 #include <istream>
 #include <fstream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <filesystem>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
 #include "seq/parser.h"
+#include "seq/disasm.h"
 
-int main(int argc, char **argv)
+struct DisasmJob
 {
-  if (argc < 2) return 1;
-  std::ifstream f = std::ifstream(argv[1], std::ios::binary);
-  if (!f) return 1;
+  std::string in_path;
+  std::string out_path;
 
+  bool ok = false;
+  uint32_t insns = 0;
+  uint32_t bad = 0;
+  uint32_t unreached = 0;
+};
+
+static void disassemble(std::istream &f, FILE *out, DisasmJob *job)
+{
   SeqParser parser;
   parser.load(f);
 
-  uint32_t pc = 0;
+  SeqDisassembler disasm(parser);
+  disasm.analyze();
+
+  DisasmWriter writer(out);
+  disasm.write(writer);
+  writer.flush();
+
+  if (job != nullptr)
+  {
+    job->insns = disasm.getInsnCount();
+    job->bad = disasm.getBadCount();
+    job->unreached = disasm.getUnreachedBytes();
+  }
+}
+
+static void run_jobs(std::vector<DisasmJob> &jobs, std::atomic<size_t> &next)
+{
   while (true)
   {
-    std::unique_ptr<SeqCommand> cmd = parser.readCommand(pc);
-    printf("%06x | ", pc);
-    for (uint32_t i = 0; i < cmd->getSize(); i++)
+    size_t i = next++;
+    if (i >= jobs.size()) return;
+
+    DisasmJob &job = jobs[i];
+    // no output file for an input that can't be read
+    std::ifstream f(job.in_path, std::ios::binary);
+    if (!f) continue;
+    FILE *out = fopen(job.out_path.c_str(), "w");
+    if (out == nullptr) continue;
+    disassemble(f, out, &job);
+    job.ok = true;
+    fclose(out);
+  }
+}
+
+/*
+  Batch mode: disassemble every file in a directory into <name>.txt,
+  spread over a pool of worker threads. The output goes to <in_dir>/disasm
+  unless given another directory.
+*/
+static int batch(const std::string &in_dir, const std::string &out_dir, uint32_t threads)
+{
+  namespace fs = std::filesystem;
+  std::error_code ec;
+  fs::create_directories(out_dir, ec);
+
+  std::vector<DisasmJob> jobs;
+  for (const fs::directory_entry &entry : fs::directory_iterator(in_dir, ec))
+  {
+    if (!entry.is_regular_file()) continue;
+    // output from an earlier run into the same directory
+    if (entry.path().extension() == ".txt") continue;
+    DisasmJob job;
+    job.in_path = entry.path().string();
+    job.out_path = (fs::path(out_dir) / entry.path().filename()).string() + ".txt";
+    jobs.push_back(job);
+  }
+  if (ec)
+  {
+    printf("Unable to read directory %s: %s\n", in_dir.c_str(), ec.message().c_str());
+    return 1;
+  }
+  // stable order so the summary can be diffed between runs
+  std::sort(jobs.begin(), jobs.end(),
+            [](const DisasmJob &a, const DisasmJob &b) { return a.in_path < b.in_path; });
+
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min<uint32_t>(threads, std::max<size_t>(jobs.size(), 1));
+
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for (uint32_t i = 0; i < threads; i++)
+  {
+    workers.emplace_back(run_jobs, std::ref(jobs), std::ref(next));
+  }
+  for (std::thread &t : workers) t.join();
+
+  int status = 0;
+  for (DisasmJob &job : jobs)
+  {
+    if (!job.ok)
+    {
+      printf("%s: failed\n", job.in_path.c_str());
+      status = 1;
+    }
+    else
     {
-      uint32_t off = i + pc;
-      if (off >= parser.seqdata.size()) printf("-- ");
-      else printf("%02x ", (uint8_t)parser.seqdata[off]);
+      printf("%s: %u instructions, %u bad, %u unreached bytes\n",
+             job.in_path.c_str(), job.insns, job.bad, job.unreached);
     }
-    printf("| %s\n", cmd->getDisasm().c_str());
-    if (dynamic_cast<BadCmd *>(cmd.get()) != nullptr)
-      break;
-    pc += cmd->getSize();
   }
+  return status;
+}
 
+static void usage(const char *name)
+{
+  printf("usage: %s <file.bms>\n", name);
+  printf("       %s -d <seq dir> [out dir] [-j threads]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (strcmp(argv[1], "-d") == 0)
+  {
+    if (argc < 3)
+    {
+      usage(argv[0]);
+      return 1;
+    }
+    std::string in_dir = argv[2];
+    std::string out_dir = (std::filesystem::path(in_dir) / "disasm").string();
+    uint32_t threads = 0;
+    for (int i = 3; i < argc; i++)
+    {
+      if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) threads = atoi(argv[++i]);
+      else out_dir = argv[i];
+    }
+    return batch(in_dir, out_dir, threads);
+  }
+
+  std::ifstream f(argv[1], std::ios::binary);
+  if (!f) return 1;
+  disassemble(f, stdout, nullptr);
   return 0;
-}
\ No newline at end of file
+}
@@ -2,6 +2,8 @@
 #include "freq_table.h"
 
 #include <cmath>
+#include <algorithm>
+#include <mutex>
 
 SampleInstr::SampleInstr(void) { }
 
@@ -93,7 +95,9 @@ void Note::start()
   if (playing) return;
   if (!isPlayable()) return;
 
-  position = 0;
+  phase = 0;
+  kernel = nullptr;
+  block_peak = HUGE_VAL;
   lastFrame[0] = 0;
   playing = true;
 }
@@ -108,6 +112,8 @@ void Note::reset()
   env.reset();
   playing = false;
   finished = false;
+  block_gain = 0;
+  pitch_curve = nullptr;
 }
 
 void Note::stopNow()
@@ -117,77 +123,156 @@ void Note::stopNow()
   finished = true;
 }
 
-static stk::StkFloat getLoopedPos(stk::StkFloat pos, uint32_t loop_start, uint32_t loop_end)
+stk::StkFloat Note::tick()
 {
-  if (pos >= loop_end - 1)
-  {
-    return std::fmod(pos - loop_start, loop_end - loop_start - 1) + loop_start;
-  }
-  else
-  {
-    return pos;
-  }
-  
+  stk::StkFloat v = 0;
+  render(&v, 1);
+  return v;
 }
 
-stk::StkFloat Note::tick()
+bool Note::beginBlock()
 {
   if (!playing)
   {
     finished = true;
-    return 0;
+    return false;
   }
   if (!isPlayable())
   {
-    playing = false;
-    finished = true;
-    return 0;
+    finish();
+    return false;
+  }
+  // a release only falls, so a note that has gone quiet there is done. a
+  // hold stays put, but the track volume can come back up over it
+  stk::StkFloat cull = 0;
+  if (env.isReleased()) cull = cull_gain;
+  else if (env.getStatus() == Envelope::HOLD) cull = hold_cull_gain;
+  if (block_peak < cull)
+  {
+    finish();
+    return false;
   }
-  stk::StkFloat envValue = env.tick();
+  block_peak = 0;
 
-  if (env.getStatus() == Envelope::FINISHED)
+  // the pitch only changes during a block if it follows a curve
+  chunk_index = 0;
+  if (pitch_curve == nullptr) setStep(pitch_adj);
+
+  stk::StkFloat vel = ((stk::StkFloat)this->vel / 127);
+  block_gain = (this->volume * this->volume) * (vel) * (volume_adj);
+  return true;
+}
+
+void Note::setStep(float adj)
+{
+  double delta = ((double)wave->sample_rate / (double)samplerate) * (double)this->pitch * (double)adj;
+  if (!isPercussion)
   {
-    // printf("note end\n");
-    playing = false;
-    finished = true;
-    return 0;
+    delta *= MIDI_NOTES[key] / MIDI_NOTES[wave->base_key];
   }
+  phase_inc = (uint64_t)std::llround(delta * Wave::PHASE_ONE);
+  level = wave->pickLevel(delta);
+}
 
-  if (!wave->loop && position >= wave->loop_end)
+uint32_t Note::prepareChunk(stk::StkFloat *gain, uint32_t n, bool &ended)
+{
+  if (pitch_curve != nullptr) setStep(pitch_curve[chunk_index++]);
+
+  // the envelope decides how many of these samples are still audible
+  uint32_t count = env.render(gain, n);
+  ended = count < n;
+  for (uint32_t i = 0; i < count; i++)
   {
-    // printf("past wave end @ %f (vol=%08x pitch=%08x)\n", position, *(uint32_t *)&volume, *(uint32_t *)&pitch);
-    playing = false;
-    finished = true;
-    return 0;
+    gain[i] *= block_gain;
+    block_peak = std::max(block_peak, std::fabs(gain[i]));
   }
 
-  double tick_delta = ((double)wave->sample_rate / (double)samplerate) * (double)this->pitch * (double)pitch_adj;
-  if (!isPercussion)
+  // one-shot waves stop once the position passes the end of the data
+  if (!wave->loop)
   {
-    tick_delta *= MIDI_NOTES[key] / MIDI_NOTES[wave->base_key];
+    uint64_t end = (uint64_t)wave->loop_end << Wave::PHASE_BITS;
+    if (phase >= end)
+    {
+      count = 0;
+      ended = true;
+    }
+    else if (phase_inc > 0)
+    {
+      // steps until the phase reaches the end, rounded up
+      uint64_t left = (end - phase + phase_inc - 1) / phase_inc;
+      if (left < count)
+      {
+        count = (uint32_t)left;
+        ended = true;
+      }
+    }
   }
-  
+  return count;
+}
 
-  stk::StkFloat vel = ((stk::StkFloat)this->vel / 127);
-  stk::StkFloat volume = envValue * (this->volume * this->volume) * (vel) * (volume_adj);
+template <Interpolator::Mode MODE, bool LOOPED>
+void Note::renderKernel(stk::StkFloat *out, const stk::StkFloat *gain, uint32_t count)
+{
+  // the guard samples around the wave keep the kernel's reads in bounds,
+  // so the phase only needs wrapping between spans
+  const stk::StkFloat *data = wave->samples(level);
+  uint32_t i = 0;
+  while (i < count)
+  {
+    uint32_t span = LOOPED ? i + wave->wrapSpan(phase, phase_inc, count - i) : count;
+    for (; i < span; i++)
+    {
+      out[i] += Interpolator::sample<MODE>(kernel_table, data, phase >> level) * gain[i];
+      phase += phase_inc;
+    }
+  }
+}
 
-  stk::StkFloat start_pos = getLoopedPos(position, wave->loop_start, wave->loop_end);
-  uint32_t start_sample = (uint32_t)start_pos;
-  uint32_t end_sample   = (uint32_t)getLoopedPos(start_sample + 1, wave->loop_start, wave->loop_end);
+template <Interpolator::Mode MODE>
+Note::Kernel Note::pickKernel(bool looped)
+{
+  return looped ? &Note::renderKernel<MODE, true> : &Note::renderKernel<MODE, false>;
+}
 
-  stk::StkFloat off = start_pos - start_sample;
-  if (end_sample > wave->loop_end) printf("end passed loop end\n");
-  
-  stk::StkFloat start = wave->data[start_sample];
-  stk::StkFloat end   = wave->data[end_sample];
+void Note::selectKernel(Interpolator::Mode mode)
+{
+  bool looped = wave->loop;
+  switch (mode)
+  {
+    case Interpolator::NEAREST: kernel = pickKernel<Interpolator::NEAREST>(looped); break;
+    case Interpolator::CUBIC:   kernel = pickKernel<Interpolator::CUBIC>(looped); break;
+    case Interpolator::SINC8:   kernel = pickKernel<Interpolator::SINC8>(looped); break;
+    case Interpolator::SINC16:  kernel = pickKernel<Interpolator::SINC16>(looped); break;
+    default:                    kernel = pickKernel<Interpolator::LINEAR>(looped); break;
+  }
+  kernel_mode = mode;
+  kernel_table = Interpolator::getTable(mode);
+}
 
-  stk::StkFloat sample = (end - start) * off + start;
+void Note::render(stk::StkFloat *out, uint32_t frames, Interpolator::Mode mode)
+{
+  if (!beginBlock()) return;
+  // only changes if the controller's mode does
+  if (kernel == nullptr || mode != kernel_mode) selectKernel(mode);
 
-  // printf("start=%u end=%u x=%.4f -> %.4f\n", start_sample, end_sample, off, sample);
+  stk::StkFloat gainBuf[ENV_CHUNK];
+  uint32_t done = 0;
+  while (done < frames)
+  {
+    uint32_t n = frames - done;
+    if (n > ENV_CHUNK) n = ENV_CHUNK;
 
-  position += tick_delta;
+    bool ended;
+    uint32_t count = prepareChunk(gainBuf, n, ended);
+    (this->*kernel)(out + done, gainBuf, count);
 
-  return sample * volume;
+    if (ended)
+    {
+      finish();
+      return;
+    }
+    done += n;
+  }
 }
 
 void Note::setOutputSampleRate(stk::StkFloat samplerate)
@@ -201,18 +286,18 @@ void Note::setOutputSampleRate(stk::StkFloat samplerate)
 void Envelope::init(Osci *osc)
 {
   this->osci = osc;
+  this->curves = nullptr;
   this->reset();
 }
 
 void Envelope::reset()
 {
   this->pos = 0;
-  this->curr_env = 0;
-  this->last_env = {0, 0, 0}; // generic envelope point
+  this->curve = (curves != nullptr) ? &curves->attack : nullptr;
   this->release = false;
   this->force_off = false;
   this->last_val = 0;
-  this->hold_val = 0;
+  this->carry_val = 0;
 }
 
 void Envelope::force_stop()
@@ -222,8 +307,12 @@ void Envelope::force_stop()
 
 void Envelope::setSamplerate(uint32_t tickrate)
 {
-  // take reciprocal
-  this->inc = 1000.0 / tickrate;
+  if (osci == nullptr) return;
+  // built with the bank for the rates an AudioSystem plays at; notes made
+  // some other way build theirs here
+  curves = findCurves(osci, tickrate);
+  if (curves == nullptr) curves = getCurves(osci, tickrate);
+  curve = release ? &curves->release : &curves->attack;
 }
 
 static double convertEnvValue(int16_t v)
@@ -231,111 +320,287 @@ static double convertEnvValue(int16_t v)
   return v / 32767.0; // may need this to be logarithmic
 }
 
-stk::StkFloat Envelope::tick()
+// append n samples of the segment from last to next, starting pos
+// milliseconds into the envelope and stepping inc each sample
+static void appendSegment(EnvCurve &curve, const Envp &last, const Envp &next, double pos,
+                          double inc, uint32_t n)
 {
-  // tick (1 sample)
-  // are we in stop or hold?
-  Envelope::Status status = getStatus();
-  stk::StkFloat next_value;
-  if (status == Envelope::HOLD)
+  // how far along the segment each sample is: 0 at last, 1 at next
+  std::vector<double> shape(n);
+
+  // total width of this vertex
+  double dt = next.time - last.time;
+  // position into the segment and its step, as a fraction of its width
+  double u = (dt > 0) ? (pos - last.time) / dt : 0;
+  double du = (dt > 0) ? inc / dt : 0;
+
+  if (next.mode == Envp::LINEAR)
   {
-    next_value = convertEnvValue(last_env.value);
+    for (uint32_t i = 0; i < n; i++)
+    {
+      shape[i] = u;
+      u += du;
+    }
   }
-  else if (status == Envelope::FINISHED)
+  else if (next.mode == Envp::SQUARE)
   {
-    next_value = 0;
+    // u^2 by its first and second differences
+    double sq = u * u;
+    double d1 = 2 * u * du + du * du;
+    double d2 = 2 * du * du;
+    for (uint32_t i = 0; i < n; i++)
+    {
+      shape[i] = sq;
+      sq += d1;
+      d1 += d2;
+    }
+  }
+  else if (next.mode == Envp::ROOT)
+  {
+    // curves are built once per bank, so there's no need to approximate
+    for (uint32_t i = 0; i < n; i++)
+    {
+      shape[i] = (u > 0) ? std::sqrt(u) : 0;
+      u += du;
+    }
   }
   else
   {
-    // check if we're on the next vertex
-    std::vector<Envp> &env_data = release ? osci->relEnv : osci->atkEnv;
+    // direct jumps straight to the next value, hold stays at the last one
+    double v = (next.mode == Envp::DIRECT) ? 1 : 0;
+    for (uint32_t i = 0; i < n; i++)
+    {
+      shape[i] = v;
+    }
+  }
 
-    if (curr_env >= env_data.size()-1)
+  bool valid = next.mode <= Envp::ROOT || next.mode == Envp::HOLD;
+  double target = convertEnvValue(next.value);
+  for (uint32_t i = 0; i < n; i++)
+  {
+    if (!valid)
+    {
+      curve.level.push_back(0);
+      curve.carry.push_back(0);
+    }
+    // the only time we have 0xff in last is at the start of the release or
+    // after a loop, where the segment starts from the carried value
+    else if (last.mode == 0xff)
+    {
+      curve.level.push_back((float)(target * shape[i]));
+      curve.carry.push_back((float)(1 - shape[i]));
+    }
+    else
     {
-      // shouldn't be here
-      printf("bad\n");
-      return 0;
+      double y = convertEnvValue(last.value);
+      curve.level.push_back((float)(y + (target - y) * shape[i]));
+      curve.carry.push_back(0);
     }
+  }
+}
 
-    Envp next_data = env_data[curr_env];
+// hold whatever the envelope reached at last
+static void endHold(EnvCurve &curve, const Envp &last)
+{
+  curve.end = EnvCurve::END_HOLD;
+  if (last.mode == 0xff)
+  {
+    curve.hold_level = 0;
+    curve.hold_carry = 1;
+  }
+  else
+  {
+    curve.hold_level = (float)convertEnvValue(last.value);
+    curve.hold_carry = 0;
+  }
+}
 
-    bool new_env = false;
-    if (pos >= next_data.time)
+static void buildCurve(EnvCurve &curve, const std::vector<Envp> &env_data, double inc, bool carried)
+{
+  // position in milliseconds
+  double pos = 0;
+  uint32_t curr_env = 0;
+  // previous envelope point
+  Envp last_env = {(uint16_t)(carried ? 0xff : 0), 0, 0};
+  // the point reached on the last sample; the next sample is always
+  // produced, even if the following point is due straight away
+  bool advanced = false;
+  bool looped = false;
+
+  while (true)
+  {
+    if (curr_env >= env_data.size())
     {
-      // printf("t=%.3f > %d - update to %d\n", pos, next_data.time, curr_env+1);
-      last_env = env_data[curr_env];
-      curr_env++;
-      next_data = env_data[curr_env];
-      new_env = true;
+      printf("WARN: Envelope has no hold or stop point\n");
+      curve.end = EnvCurve::END_HOLD;
+      return;
     }
+    const Envp &next_data = env_data[curr_env];
 
-    // total width of this vertex
-    double dt = next_data.time - last_env.time;
-    // position into that time
-    double t = pos - last_env.time;
-    // starting value
-    double y;
-    // the only time we have 0xff in last_env is after beginRelease was called.
-    if (last_env.mode == 0xff) y = hold_val;
-    else y = convertEnvValue(last_env.value);
-    // value difference
-    double dy = convertEnvValue(next_data.value) - y;
-
-    /*
-    if (new_env)
+    if (next_data.mode == Envp::STOP)
+    {
+      curve.end = EnvCurve::END_STOP;
+      return;
+    }
+    if (next_data.mode == Envp::HOLD)
     {
-      printf("t=%.3f [%u]: %02x over %.0f ticks from %.3f to %.3f\n", pos, curr_env, next_data.mode, dt, y, y+dy);
+      endHold(curve, last_env);
+      return;
+    }
+    if (next_data.mode == Envp::LOOP)
+    {
+      // jump back to the point index in the value. times are absolute, so
+      // the loop starts from the time of the point before its target
+      uint16_t target = (uint16_t)next_data.value;
+      if (target >= curr_env)
+      {
+        // a loop has to jump backwards; anything else just holds
+        endHold(curve, last_env);
+        return;
+      }
+      if (looped)
+      {
+        // once round the loop body; it plays the same from here on
+        if (curve.level.size() == curve.loop_start) endHold(curve, last_env);
+        else curve.end = EnvCurve::END_LOOP;
+        return;
+      }
+      looped = true;
+      curve.loop_start = curve.level.size();
+      uint16_t start = (target > 0) ? env_data[target - 1].time : 0;
+      last_env = {0xff, start, 0};
+      pos = start;
+      curr_env = target;
+      advanced = false;
+      continue;
     }
-    */
 
-    // increment time
-    // TODO test if this should increment by inc or just 1
-    pos += inc;
+    if (!advanced && pos >= next_data.time)
+    {
+      last_env = next_data;
+      curr_env++;
+      advanced = true;
+      continue;
+    }
 
-    if (next_data.mode == Envp::LINEAR)
+    if (curr_env >= env_data.size() - 1)
     {
-      next_value = y + dy * (t / dt);
+      // nothing after this point to stop on
+      printf("WARN: Envelope has no hold or stop point\n");
+      curve.end = EnvCurve::END_HOLD;
+      return;
     }
-    else if (next_data.mode == Envp::SQUARE)
+
+    // samples left before the next point is reached
+    uint32_t count = 1;
+    if (pos < next_data.time)
     {
-      next_value = y + dy * (t / dt) * (t / dt);
+      count = (uint32_t)std::ceil((next_data.time - pos) / inc);
     }
-    else if (next_data.mode == Envp::ROOT)
+    appendSegment(curve, last_env, next_data, pos, inc, count);
+    pos += inc * count;
+    advanced = false;
+  }
+}
+
+// building is serialized in case notes outside an AudioSystem start on
+// several threads. each EnvCurves is allocated on its own and lives as long
+// as the bank, so the pointers handed out stay valid while the list grows
+static std::mutex curves_lock;
+
+const EnvCurves *Envelope::findCurves(const Osci *osci, stk::StkFloat rate)
+{
+  for (const std::unique_ptr<EnvCurves> &c : osci->curves)
+  {
+    if (c->rate == rate) return c.get();
+  }
+  return nullptr;
+}
+
+const EnvCurves *Envelope::getCurves(Osci *osci, stk::StkFloat rate)
+{
+  std::lock_guard<std::mutex> lock(curves_lock);
+  const EnvCurves *found = findCurves(osci, rate);
+  if (found != nullptr) return found;
+
+  EnvCurves *c = new EnvCurves();
+  c->rate = rate;
+  double inc = 1000.0 / rate;
+  buildCurve(c->attack, osci->atkEnv, inc, false);
+  buildCurve(c->release, osci->relEnv, inc, true);
+  osci->curves.push_back(std::unique_ptr<EnvCurves>(c));
+  return c;
+}
+
+stk::StkFloat Envelope::tick()
+{
+  stk::StkFloat v = 0;
+  render(&v, 1);
+  return v;
+}
+
+uint32_t Envelope::render(stk::StkFloat *out, uint32_t n)
+{
+  if (curve == nullptr)
+  {
+    for (uint32_t i = 0; i < n; i++) out[i] = 0;
+    return n;
+  }
+  if (force_off) return 0;
+
+  uint32_t i = 0;
+  while (i < n)
+  {
+    uint32_t size = curve->level.size();
+    bool looping = curve->end == EnvCurve::END_LOOP;
+    // the loop body carries on from wherever the envelope got to, the first
+    // time round as well
+    if (looping && pos == curve->loop_start) carry_val = last_val;
+    if (pos < size)
     {
-      next_value = y + dy * std::sqrt(t / dt);
+      uint32_t count = n - i;
+      if (size - pos < count) count = size - pos;
+      if (looping && pos < curve->loop_start && curve->loop_start - pos < count)
+      {
+        count = curve->loop_start - pos;
+      }
+      const float *level = &curve->level[pos];
+      const float *carry = &curve->carry[pos];
+      for (uint32_t k = 0; k < count; k++)
+      {
+        out[i + k] = level[k] + carry[k] * carry_val;
+      }
+      i += count;
+      pos += count;
+      last_val = out[i - 1];
+      continue;
     }
-    else if (next_data.mode == Envp::DIRECT)
+
+    if (looping)
     {
-      next_value = y + dy * 1;
+      pos = curve->loop_start;
     }
-    else if (next_data.mode == Envp::HOLD)
+    else if (curve->end == EnvCurve::END_HOLD)
     {
-      next_value = y;
+      stk::StkFloat v = curve->hold_level + curve->hold_carry * carry_val;
+      for (; i < n; i++) out[i] = v;
+      last_val = v;
     }
     else
     {
-      // stop or invalid
-      next_value = 0;
+      return i;
     }
   }
-
-  last_val = next_value;
-  return next_value;
+  return n;
 }
 
 Envelope::Status Envelope::getStatus()
 {
-  if (osci == nullptr) return EMPTY;
+  if (curve == nullptr) return EMPTY;
   else if (force_off) return FINISHED;
-  else
-  {
-    std::vector<Envp> &env_data = release ? osci->relEnv : osci->atkEnv;
-    Envp &env = env_data[curr_env];
-
-    if (env.mode == Envp::STOP) return FINISHED;
-    else if (env.mode == Envp::HOLD) return HOLD;
-    else return ACTIVE;
-  }
+  else if (pos < curve->level.size() || curve->end == EnvCurve::END_LOOP) return ACTIVE;
+  else if (curve->end == EnvCurve::END_HOLD) return HOLD;
+  else return FINISHED;
 }
 
 void Envelope::beginRelease()
@@ -345,10 +610,8 @@ void Envelope::beginRelease()
     // printf("release\n");
     release = true;
     pos = 0;
-    curr_env = 0;
-    last_env = {0xff, 0, 0};
-
-    hold_val = last_val;
+    if (curves != nullptr) curve = &curves->release;
+    carry_val = last_val;
   }
   else
   {
@@ -356,6 +619,14 @@ void Envelope::beginRelease()
   }
 }
 
+uint32_t Envelope::getLength(bool release)
+{
+  if (curves == nullptr) return UINT32_MAX;
+  const EnvCurve &c = release ? curves->release : curves->attack;
+  if (c.end != EnvCurve::END_STOP) return UINT32_MAX;
+  return c.level.size();
+}
+
 stk::StkFloat Envelope::getValue()
 {
   return last_val;
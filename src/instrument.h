@@ -9,24 +9,26 @@
 #include <string>
 
 #include "banks.h"
+#include "interp.h"
 
 class Envelope
 {
 private:
-  double pos;
-  double inc;
-  uint32_t curr_env;
   Osci *osci = nullptr;
+  // curves for the current output rate, and the one being played
+  const EnvCurves *curves = nullptr;
+  const EnvCurve *curve = nullptr;
+  // samples into curve
+  uint32_t pos;
 
   bool release = false;
   bool force_off = false;
 
-  // previous envelope point
-  Envp last_env;
   // last value generated
   stk::StkFloat last_val;
-  // last value generated before release activated
-  stk::StkFloat hold_val;
+  // value the carried part of the curve starts from (see EnvCurve)
+  stk::StkFloat carry_val;
+
 public:
   enum Status
   {
@@ -47,23 +49,86 @@ public:
   Status getStatus();
 
   stk::StkFloat tick();
+  // the next n values. returns how many were produced before the envelope
+  // finished
+  uint32_t render(stk::StkFloat *out, uint32_t n);
 
   stk::StkFloat getValue();
 
   const Osci *getOscillator() { return osci; }
 
   void beginRelease();
+  bool isReleased() { return release; }
+  // samples from the start of the attack (or release) to where the envelope
+  // stops; UINT32_MAX if it holds or loops instead
+  uint32_t getLength(bool release);
+
+  // osci's envelopes rendered at `rate`, built the first time they're asked
+  // for and kept with the oscillator. safe to call from any thread, but
+  // building allocates; AudioSystem::addSampleRate() does it up front
+  static const EnvCurves *getCurves(Osci *osci, stk::StkFloat rate);
+  // the curves for `rate` if they have been built, else nullptr
+  static const EnvCurves *findCurves(const Osci *osci, stk::StkFloat rate);
 };
 
 class Note
 {
+  friend class VoiceMixer;
+  friend class AudioSystem;
+
 private:
-  stk::StkFloat position = 0;
+  // read position in the wave, Wave::PHASE_BITS fixed point
+  uint64_t phase = 0;
   bool finished = false;
   bool playing = false;
   stk::StkFrames lastFrame;
   stk::StkFloat samplerate;
 
+  // set up by beginBlock() for the current block, or by prepareChunk() for
+  // each chunk if the pitch follows pitch_curve
+  uint64_t phase_inc = 0;
+  // band-limited level of the wave being read (see Wave::pickLevel())
+  uint32_t level = 0;
+  uint32_t chunk_index = 0;
+  stk::StkFloat block_gain = 0;
+  // loudest gain over the block, for culling
+  stk::StkFloat block_peak = 0;
+
+  // false if the note has nothing to render
+  bool beginBlock();
+  // phase_inc and level for the note's pitch times adj
+  void setStep(float adj);
+  // fill gain[] with envelope * note gain for the next n samples; returns
+  // how many of them are audible (ended is set if the note stops there)
+  uint32_t prepareChunk(stk::StkFloat *gain, uint32_t n, bool &ended);
+  void finish()
+  {
+    playing = false;
+    finished = true;
+  }
+
+  // renders the audible part of one chunk. instantiated for every
+  // interpolation mode and for looped/one-shot waves, and picked when the
+  // note starts, so the inner loop has nothing left to decide
+  typedef void (Note::*Kernel)(stk::StkFloat *out, const stk::StkFloat *gain, uint32_t count);
+  Kernel kernel = nullptr;
+  Interpolator::Mode kernel_mode = Interpolator::NUM_MODES;
+  const double *kernel_table = nullptr;
+
+  template <Interpolator::Mode MODE, bool LOOPED>
+  void renderKernel(stk::StkFloat *out, const stk::StkFloat *gain, uint32_t count);
+  template <Interpolator::Mode MODE>
+  static Kernel pickKernel(bool looped);
+  void selectKernel(Interpolator::Mode mode);
+
+  // voice pool links; free notes are chained through pool_next, busy ones
+  // are kept oldest first
+  Note *pool_prev = nullptr;
+  Note *pool_next = nullptr;
+  bool pool_busy = false;
+  // changes whenever the pool takes the note back
+  uint32_t serial = 0;
+
 public:
   Wave *wave;
   float volume;
@@ -76,6 +141,15 @@ public:
 
   float volume_adj = 1;
   float pitch_adj = 1;
+  // if set, used in place of pitch_adj: one value for each ENV_CHUNK samples
+  // of the next block rendered, in order
+  const float *pitch_curve = nullptr;
+  // sequence tick the note was started on
+  uint32_t started = 0;
+  // once released, the note is stopped if its gain stays below cull_gain
+  // for a whole block; while holding, below hold_cull_gain
+  stk::StkFloat cull_gain = 0;
+  stk::StkFloat hold_cull_gain = 0;
 
   Note(void)
   {
@@ -97,16 +171,43 @@ public:
     return playing;
   }
 
+  uint32_t getSerial()
+  {
+    return serial;
+  }
+
+  // envelope * note gain as of the last block rendered; 0 before the first
+  stk::StkFloat getLevel()
+  {
+    return env.getValue() * block_gain;
+  }
+
   void start();
   void stop();
   void stopNow();
   void reset();
 
+  static const uint32_t ENV_CHUNK = 64;
+
   stk::StkFloat tick();
+  // add the next `frames` samples of this note into out. this is the scalar
+  // reference path; tracks normally mix their notes through VoiceMixer
+  void render(stk::StkFloat *out, uint32_t frames, Interpolator::Mode mode = Interpolator::LINEAR);
 
   void setOutputSampleRate(stk::StkFloat samplerate);
 };
 
+// a note as handed out by the voice pool. the pool can take the note back
+// (when it finishes, or to steal it for a new one), after which get() is null
+struct NoteRef
+{
+  Note *note;
+  uint32_t serial;
+
+  NoteRef(Note *note) : note(note), serial(note->getSerial()) {}
+  Note *get() const { return note->getSerial() == serial ? note : nullptr; }
+};
+
 class SampleInstr
 {
 private:
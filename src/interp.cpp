@@ -0,0 +1,94 @@
+#include "interp.h"
+
+#include <cmath>
+#include <vector>
+#include <string.h>
+
+static const char *MODE_NAMES[Interpolator::NUM_MODES] = {
+  "nearest", "linear", "cubic", "sinc8", "sinc16"
+};
+
+static const uint32_t MODE_TAPS[Interpolator::NUM_MODES] = {
+  1, 2, 4, 8, 16
+};
+
+static std::vector<double> buildCubic()
+{
+  std::vector<double> table((Interpolator::PHASES + 1) * 4);
+  for (uint32_t r = 0; r <= Interpolator::PHASES; r++)
+  {
+    double t = (double)r / Interpolator::PHASES;
+    double t2 = t * t;
+    double t3 = t2 * t;
+    double *row = &table[r * 4];
+    row[0] = -0.5 * t3 +       t2 - 0.5 * t;
+    row[1] =  1.5 * t3 - 2.5 * t2           + 1;
+    row[2] = -1.5 * t3 + 2.0 * t2 + 0.5 * t;
+    row[3] =  0.5 * t3 - 0.5 * t2;
+  }
+  return table;
+}
+
+static std::vector<double> buildSinc(uint32_t taps)
+{
+  std::vector<double> table((Interpolator::PHASES + 1) * taps);
+  double half = taps / 2;
+  for (uint32_t r = 0; r <= Interpolator::PHASES; r++)
+  {
+    double t = (double)r / Interpolator::PHASES;
+    double *row = &table[r * taps];
+    double sum = 0;
+    for (uint32_t k = 0; k < taps; k++)
+    {
+      // distance from the output position to this tap
+      double x = (double)k - (half - 1) - t;
+      double s = (x == 0) ? 1 : std::sin(M_PI * x) / (M_PI * x);
+      double w = 0.42 + 0.5 * std::cos(M_PI * x / half) + 0.08 * std::cos(2 * M_PI * x / half);
+      row[k] = s * w;
+      sum += row[k];
+    }
+    // unity gain at DC, so quiet passages don't pick up a ripple
+    for (uint32_t k = 0; k < taps; k++)
+    {
+      row[k] /= sum;
+    }
+  }
+  return table;
+}
+
+uint32_t Interpolator::getTaps(Mode mode)
+{
+  if (mode >= NUM_MODES) return MODE_TAPS[LINEAR];
+  return MODE_TAPS[mode];
+}
+
+const double *Interpolator::getTable(Mode mode)
+{
+  // built on first use
+  static const std::vector<double> cubic = buildCubic();
+  static const std::vector<double> sinc8 = buildSinc(8);
+  static const std::vector<double> sinc16 = buildSinc(16);
+
+  switch (mode)
+  {
+    case CUBIC:  return cubic.data();
+    case SINC8:  return sinc8.data();
+    case SINC16: return sinc16.data();
+    default:     return nullptr;
+  }
+}
+
+const char *Interpolator::getName(Mode mode)
+{
+  if (mode >= NUM_MODES) return "unknown";
+  return MODE_NAMES[mode];
+}
+
+Interpolator::Mode Interpolator::fromName(const char *name)
+{
+  for (uint32_t i = 0; i < NUM_MODES; i++)
+  {
+    if (strcmp(name, MODE_NAMES[i]) == 0) return (Mode)i;
+  }
+  return NUM_MODES;
+}
@@ -0,0 +1,91 @@
+#ifndef SYNTH_INTERP_H
+#define SYNTH_INTERP_H
+
+#include <stdint.h>
+#include <stk/Stk.h>
+
+#include "banks.h"
+
+/*
+  Resampling kernels used to read waves at a fractional phase.
+
+  The cubic and sinc kernels are polyphase: the fractional part of the phase
+  picks one of PHASES + 1 precomputed rows of coefficients, which is then
+  applied to the samples around the position. Rough cost per voice per
+  output sample:
+
+    mode     reads  multiply-adds  table
+    nearest    1         0         -
+    linear     2         1         -
+    cubic      4         4         32 KB  (Catmull-Rom)
+    sinc8      8         8         64 KB  (Blackman-windowed sinc)
+    sinc16    16        16        128 KB
+
+  A kernel with N taps reads from idx - (N / 2 - 1) to idx + N / 2, which
+  Wave::GUARD_SAMPLES covers on both sides.
+*/
+class Interpolator
+{
+public:
+  enum Mode
+  {
+    NEAREST,
+    LINEAR,
+    CUBIC,
+    SINC8,
+    SINC16,
+    NUM_MODES
+  };
+
+  static const uint32_t PHASE_BITS = 10;
+  static const uint32_t PHASES = 1 << PHASE_BITS;
+  static const uint32_t MAX_TAPS = 16;
+
+  static uint32_t getTaps(Mode mode);
+  // (PHASES + 1) rows of getTaps(mode) coefficients; nullptr for nearest and
+  // linear, which are computed directly
+  static const double *getTable(Mode mode);
+
+  // table row for the fractional part of a wave phase
+  static uint32_t getRow(uint32_t frac)
+  {
+    return (uint32_t)(((uint64_t)frac + (1ULL << (31 - PHASE_BITS))) >> (32 - PHASE_BITS));
+  }
+
+  // one sample of data at phase (Wave::PHASE_BITS fixed point). table is
+  // getTable(MODE)
+  template <Mode MODE>
+  static stk::StkFloat sample(const double *table, const stk::StkFloat *data, uint64_t phase)
+  {
+    uint32_t idx = (uint32_t)(phase >> Wave::PHASE_BITS);
+    uint32_t frac = (uint32_t)phase;
+
+    if (MODE == NEAREST)
+    {
+      return data[(uint32_t)((phase + (Wave::PHASE_ONE >> 1)) >> Wave::PHASE_BITS)];
+    }
+    else if (MODE == LINEAR)
+    {
+      stk::StkFloat off = frac * (1.0 / Wave::PHASE_ONE);
+      return (data[idx + 1] - data[idx]) * off + data[idx];
+    }
+    else
+    {
+      const uint32_t taps = (MODE == CUBIC) ? 4 : (MODE == SINC8) ? 8 : 16;
+      const double *row = table + getRow(frac) * taps;
+      const stk::StkFloat *src = data + idx - (taps / 2 - 1);
+      stk::StkFloat v = 0;
+      for (uint32_t k = 0; k < taps; k++)
+      {
+        v += row[k] * src[k];
+      }
+      return v;
+    }
+  }
+
+  static const char *getName(Mode mode);
+  // NUM_MODES if the name isn't recognized
+  static Mode fromName(const char *name);
+};
+
+#endif // SYNTH_INTERP_H
@@ -0,0 +1,34 @@
+#include "lfo.h"
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+static std::vector<float> buildSine()
+{
+  std::vector<float> table(Lfo::TABLE_SIZE + 1);
+  for (uint32_t i = 0; i <= Lfo::TABLE_SIZE; i++)
+  {
+    table[i] = (float)std::sin(2 * M_PI * i / Lfo::TABLE_SIZE);
+  }
+  return table;
+}
+
+// built at startup, so reading it while rendering never allocates
+static const std::vector<float> sine = buildSine();
+
+const float *Lfo::getSineTable()
+{
+  return sine.data();
+}
+
+float Lfo::getValue(double ticks) const
+{
+  const float *table = getSineTable();
+  double p = std::fmod(phase + rate * ticks, (double)(1 << PHASE_BITS));
+  double pos = p / (1 << (PHASE_BITS - TABLE_BITS));
+  uint32_t i = std::min((uint32_t)pos, TABLE_SIZE - 1);
+  float frac = (float)(pos - i);
+  float v = table[i] + (table[i + 1] - table[i]) * frac;
+  return v * depth;
+}
@@ -0,0 +1,42 @@
+#ifndef SYNTH_LFO_H
+#define SYNTH_LFO_H
+
+#include <stdint.h>
+
+/*
+  Low-frequency oscillator for control-rate modulation such as vibrato.
+  Every LFO reads the same sine table, so a value costs a table lookup and
+  a multiply. The phase moves on by the rate every sequence tick; it can be
+  read at any point in between, so a block spanning many ticks can follow
+  it without the sequence stopping on each one.
+*/
+class Lfo
+{
+public:
+  // one cycle of phase is 1 << PHASE_BITS
+  static const uint32_t PHASE_BITS = 16;
+  static const uint32_t TABLE_BITS = 8;
+  static const uint32_t TABLE_SIZE = 1 << TABLE_BITS;
+
+private:
+  uint32_t phase = 0;
+  uint32_t rate = 0;
+  float depth = 0;
+
+public:
+  // phase step per tick
+  void setRate(uint32_t rate) { this->rate = rate; }
+  void setDepth(float depth) { this->depth = depth; }
+  void reset() { phase = 0; }
+  bool isActive() const { return rate != 0 && depth != 0; }
+
+  // move the phase on by this many ticks
+  void advance(uint32_t ticks) { phase = (phase + rate * ticks) & ((1 << PHASE_BITS) - 1); }
+  // value `ticks` after the current phase, scaled by depth
+  float getValue(double ticks) const;
+
+  // sin over one cycle, TABLE_SIZE + 1 entries
+  static const float *getSineTable();
+};
+
+#endif // SYNTH_LFO_H
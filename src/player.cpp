@@ -1,16 +1,31 @@
 #include <string>
+#include <stdlib.h>
+#include <string.h>
 #include <fstream>
 #include <istream>
+#include <thread>
+#include <atomic>
 
 #include "seq/parser.h"
 #include "seq/track.h"
 #include "audio/audio_out.h"
 #include "audio_system.h"
 
+#include <SDL2/SDL.h>
+
+
+static void usage(const char *name)
+{
+  printf("usage: %s <file.bms> [interpolation] [-mip] [-j threads]\n", name);
+}
 
 void test_seq_play(char **argv, int argc)
 {
-  if (argc < 2) return;
+  if (argc < 2)
+  {
+    usage(argv[0]);
+    return;
+  }
   std::string fname = std::string(argv[1]);
   std::ifstream f(fname);
   if (!f) return;
@@ -22,16 +37,53 @@ void test_seq_play(char **argv, int argc)
 
   SeqController controller(system, parser, 44100);
   controller.loop_limit = -1;
+  controller.cache_loops = true; // stop rendering once the song loops
   controller.volume = 0.3;
+  controller.max_block = 512; // keep blocks short for live output
+  for (int i = 2; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) controller.setRenderThreads(atoi(argv[++i])); // 0 = one per core
+    else if (strcmp(argv[i], "-mip") == 0) system.setMipLevels(4); // clean up to 4 octaves above the recorded pitch
+    else if (argv[i][0] == '-')
+    {
+      printf("WARN: Unknown option %s\n", argv[i]);
+      usage(argv[0]);
+    }
+    else
+    {
+      Interpolator::Mode mode = Interpolator::fromName(argv[i]);
+      if (mode == Interpolator::NUM_MODES) printf("WARN: Unknown interpolation mode %s; using linear\n", argv[i]);
+      else controller.interp_mode = mode;
+    }
+  }
   
   stk::Stk::setSampleRate(44100);
   SDLAudioOut out(44100);
-  while (true)
+  std::atomic<bool> done{false};
+  std::thread render([&]()
   {
-    if (!controller.tick(out)) break;
-    controller.ext_info = "buf size: " + std::to_string(out.getQueueSize());
+    while (true)
+    {
+      if (!controller.tick(out)) break;
+      snprintf(controller.ext_info, sizeof(controller.ext_info), "buf size: %u | underruns: %llu",
+               out.getQueueSize(), (unsigned long long)out.getUnderruns());
+
+      if (out.bad()) break;
+    }
+    out.finish();
+    done = true;
+  });
 
-    if (out.bad()) break;
+  while (!done)
+  {
+    if (!out.pollEvents()) break;
+    SDL_Delay(10);
+  }
+  render.join();
+  if (out.getUnderruns() > 0)
+  {
+    printf("%llu underruns, %.3fs of silence\n", (unsigned long long)out.getUnderruns(),
+           out.getUnderrunFrames() / 44100.0);
   }
 }
 
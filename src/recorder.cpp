@@ -3,9 +3,15 @@
 #include "audio_system.h"
 #include "seq/parser.h"
 #include "seq/track.h"
+#include "seq/segment_render.h"
+#include "seq/note_render.h"
+#include "audio/loop_wav_out.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <cmath>
+#include <algorithm>
 
 #include <stk/FileWvOut.h>
 // #include <stk/RtWvOut.h>
@@ -29,13 +35,12 @@ void test_audio(void)
   stk::Stk::setSampleRate(44100);
   stk::FileWvOut out("test.wav");
 
-  Note *n = system.getNewNote();
-  inst.createNote(60, 63, n);
-
-  n->env.setSamplerate(44100);
-
   for (int j = 0; j < 3; j++)
   {
+    // tickAllNotes() gives the note back once it finishes
+    Note *n = system.getNewNote();
+    inst.createNote(60, 63, n);
+
     printf("atk: ");
     for (const Envp &env : n->env.getOscillator()->atkEnv)
     {
@@ -67,8 +72,6 @@ void test_audio(void)
       i++;
     }
     printf("rel for %d samples\n", i);
-
-    n->reset();
   }
 
 }
@@ -97,10 +100,56 @@ void test_seq(void)
   }
 }
 
+// gives up on finding a loop after this many seconds
+static const uint64_t LOOP_EXPORT_LIMIT = 60 * 30;
+
+void export_loop(SeqController &controller, std::string fname)
+{
+  float rate = controller.getSamplerate();
+  LoopWavOut out(fname, (uint32_t)rate);
+  controller.loop_limit = -1;
+  controller.cache_loops = true;
+  // once the controller is playing its recorded time round back, the file
+  // has the intro, the first time round and the recorded one
+  while (!controller.isPlayingCachedLoop() && controller.getSamplesProcessed() < LOOP_EXPORT_LIMIT * rate)
+  {
+    if (!controller.tick(out)) break;
+  }
+  if (controller.isPlayingCachedLoop())
+  {
+    // the first time round has the end of the intro ringing into it, where
+    // the recorded one has the end of the time round before. the loop
+    // starts once the two agree, so the intro plays out in full and the
+    // loop end runs back into audio that followed the same thing. the two
+    // can be a sample apart in length, so they're lined up by their ends
+    uint64_t first = controller.getLoopFirstSeen();
+    uint64_t start = controller.getLoopStart();
+    uint64_t length = controller.getLoopLength();
+    uint64_t pass = std::min(start - first, length);
+    uint64_t from = start - pass + out.matchesFrom(start - pass, start, pass);
+    out.truncate(from + length);
+    out.setLoop(from, from + length);
+    printf("%.3fs intro, %.3fs loop\n", from / rate, length / rate);
+  }
+  else
+  {
+    printf("WARN: No loop found; writing the sequence without loop points\n");
+  }
+  out.close();
+}
+
+static void usage(const char *name)
+{
+  printf("usage: %s <file.bms> [interpolation] [-mip] [-j threads] [-split | -notes | -loop]\n", name);
+}
 
 void test_seq_play(char **argv, int argc)
 {
-  if (argc < 2) return;
+  if (argc < 2)
+  {
+    usage(argv[0]);
+    return;
+  }
   std::string fname = std::string(argv[1]);
   std::ifstream f(fname);
   f.get(); // try to read a byte
@@ -114,8 +163,59 @@ void test_seq_play(char **argv, int argc)
   SeqController controller(system, parser, 44100);
   
   stk::Stk::setSampleRate(44100);
-  stk::FileWvOut out(fname + ".wav", 2);
   controller.volume = 0.3;
+  uint32_t threads = 1;
+  std::string render = "tracks";
+  for (int i = 2; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) threads = atoi(argv[++i]); // 0 = one per core
+    else if (strcmp(argv[i], "-mip") == 0) system.setMipLevels(4); // clean up to 4 octaves above the recorded pitch
+    else if (strcmp(argv[i], "-split") == 0 || strcmp(argv[i], "-notes") == 0 || strcmp(argv[i], "-loop") == 0)
+    {
+      render = argv[i] + 1;
+    }
+    else if (argv[i][0] == '-')
+    {
+      printf("WARN: Unknown option %s\n", argv[i]);
+      usage(argv[0]);
+    }
+    else
+    {
+      Interpolator::Mode mode = Interpolator::fromName(argv[i]);
+      if (mode == Interpolator::NUM_MODES) printf("WARN: Unknown interpolation mode %s; using linear\n", argv[i]);
+      else controller.interp_mode = mode;
+    }
+  }
+  if (render == "loop")
+  {
+    // the intro and a single loop, marked for players to repeat
+    controller.setRenderThreads(threads);
+    export_loop(controller, fname + ".wav");
+    return;
+  }
+  stk::FileWvOut out(fname + ".wav", 2);
+  if (render == "split")
+  {
+    // whole segments of the song on each thread, instead of tracks
+    SegmentRenderer renderer(system, parser, 44100);
+    renderer.volume = controller.volume;
+    renderer.interp_mode = controller.interp_mode;
+    renderer.render(out, threads);
+    printf("%u segments, %.3fs of lead-in rendered for %.3fs of audio\n", renderer.getNumSegments(),
+           renderer.getWarmupSamples() / 44100.0, renderer.getLength() / 44100.0);
+    return;
+  }
+  if (render == "notes")
+  {
+    // every note on its own, then mixed down
+    NoteRenderer renderer(system, parser, 44100);
+    renderer.volume = controller.volume;
+    renderer.interp_mode = controller.interp_mode;
+    renderer.render(out, threads);
+    printf("%u notes, %.3fs of audio\n", renderer.getNumNotes(), renderer.getLength() / 44100.0);
+    return;
+  }
+  controller.setRenderThreads(threads);
   while (true)
   {
     if (!controller.tick(out)) break;
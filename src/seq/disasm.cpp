@@ -0,0 +1,291 @@
+#include "disasm.h"
+
+#include <string.h>
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+// widest instruction is 6 bytes; keeps the text column aligned
+static const uint32_t BYTE_COLUMNS = 6;
+static const uint32_t DATA_PER_LINE = 6;
+
+DisasmWriter::DisasmWriter(FILE *out, size_t size)
+  : out(out), buf(size)
+{
+}
+
+DisasmWriter::~DisasmWriter()
+{
+  flush();
+}
+
+char *DisasmWriter::reserve(size_t n)
+{
+  if (buf.size() - used < n) flush();
+  return buf.data() + used;
+}
+
+void DisasmWriter::flush()
+{
+  if (used > 0 && out != nullptr)
+  {
+    fwrite(buf.data(), 1, used, out);
+  }
+  used = 0;
+}
+
+void DisasmWriter::put(char c)
+{
+  *reserve(1) = c;
+  used++;
+}
+
+void DisasmWriter::put(const char *s)
+{
+  size_t n = strlen(s);
+  memcpy(reserve(n), s, n);
+  used += n;
+}
+
+void DisasmWriter::hex(uint32_t v, uint32_t digits)
+{
+  char *p = reserve(digits);
+  for (uint32_t i = 0; i < digits; i++)
+  {
+    p[digits - i - 1] = HEX_DIGITS[v & 0xF];
+    v >>= 4;
+  }
+  used += digits;
+}
+
+void DisasmWriter::pad(uint32_t n)
+{
+  memset(reserve(n), ' ', n);
+  used += n;
+}
+
+SeqDisassembler::SeqDisassembler(SeqParser &parser) : parser(parser) { }
+
+void SeqDisassembler::queue(uint32_t pc, uint8_t flag)
+{
+  if (pc >= flags.size())
+  {
+    num_bad++;
+    return;
+  }
+  flags[pc] |= flag;
+  if (!(flags[pc] & FLAG_QUEUED))
+  {
+    flags[pc] |= FLAG_QUEUED;
+    worklist.push_back(pc);
+  }
+}
+
+void SeqDisassembler::trace(uint32_t pc)
+{
+  while (pc < flags.size())
+  {
+    if (flags[pc] & (FLAG_START | FLAG_BAD)) return; // already visited
+    if (flags[pc] & FLAG_CODE)
+    {
+      // control flow lands in the middle of another instruction
+      num_overlaps++;
+      return;
+    }
+
+    SeqCommand *c = parser.readCommand(pc, slot);
+    if (dynamic_cast<BadCmd *>(c) != nullptr)
+    {
+      flags[pc] |= FLAG_BAD;
+      num_bad++;
+      return;
+    }
+
+    uint32_t size = c->getSize();
+    for (uint32_t i = 1; i < size; i++)
+    {
+      if (flags[pc + i] & (FLAG_CODE | FLAG_BAD))
+      {
+        num_overlaps++;
+        return;
+      }
+    }
+
+    flags[pc] |= FLAG_START;
+    for (uint32_t i = 0; i < size; i++)
+    {
+      flags[pc + i] |= FLAG_CODE;
+    }
+    num_insns++;
+    pc += size;
+
+    {
+      CmdOpenTrack *cmd_ = dynamic_cast<CmdOpenTrack *>(c);
+      if (cmd_ != nullptr)
+      {
+        if (cmd_->getOffset() < track_ids.size()) track_ids[cmd_->getOffset()] = cmd_->getTrackID();
+        queue(cmd_->getOffset(), FLAG_TRACK);
+        continue;
+      }
+    }
+
+    {
+      CmdJump *cmd_ = dynamic_cast<CmdJump *>(c);
+      if (cmd_ != nullptr)
+      {
+        queue(cmd_->getTarget(), cmd_->isCall() ? FLAG_CALL : FLAG_JUMP);
+        if (cmd_->isCall()) continue;
+        else return;
+      }
+    }
+
+    {
+      // conditional; both paths are reachable
+      CmdJumpF *cmd_ = dynamic_cast<CmdJumpF *>(c);
+      if (cmd_ != nullptr)
+      {
+        queue(cmd_->getTarget(), cmd_->isCall() ? FLAG_CALL : FLAG_JUMP);
+        continue;
+      }
+    }
+
+    if (dynamic_cast<CmdReturn *>(c) != nullptr) return;
+    if (dynamic_cast<CmdTrackEnd *>(c) != nullptr) return;
+  }
+}
+
+void SeqDisassembler::analyze()
+{
+  uint32_t size = parser.seqdata.size();
+  flags.assign(size, 0);
+  track_ids.assign(size, 0);
+  worklist.clear();
+  num_insns = 0;
+  num_bad = 0;
+  num_overlaps = 0;
+
+  if (size == 0) return;
+
+  track_ids[0] = 255; // root track, same as SeqController
+  queue(0, FLAG_TRACK);
+  while (!worklist.empty())
+  {
+    uint32_t pc = worklist.back();
+    worklist.pop_back();
+    trace(pc);
+  }
+}
+
+uint32_t SeqDisassembler::getUnreachedBytes()
+{
+  uint32_t total = 0;
+  for (uint8_t f : flags)
+  {
+    if (!(f & (FLAG_CODE | FLAG_BAD))) total++;
+  }
+  return total;
+}
+
+void SeqDisassembler::writeLabel(DisasmWriter &out, uint32_t pc)
+{
+  uint8_t f = flags[pc];
+  out.put('\n');
+  if (f & FLAG_TRACK)
+  {
+    char *p = out.reserve(32);
+    out.commit(snprintf(p, 32, "track_%u_%06x:\n", track_ids[pc], pc));
+  }
+  if (f & FLAG_CALL)
+  {
+    out.put("sub_");
+    out.hex(pc, 6);
+    out.put(":\n");
+  }
+  if (f & FLAG_JUMP)
+  {
+    out.put("loc_");
+    out.hex(pc, 6);
+    out.put(":\n");
+  }
+}
+
+uint32_t SeqDisassembler::writeInsn(DisasmWriter &out, uint32_t pc)
+{
+  SeqCommand *cmd = parser.readCommand(pc, slot);
+  uint32_t size = cmd->getSize();
+
+  out.hex(pc, 6);
+  out.put(" | ");
+  for (uint32_t i = 0; i < size; i++)
+  {
+    out.hex(parser.seqdata[pc + i], 2);
+    out.put(' ');
+  }
+  if (size < BYTE_COLUMNS) out.pad((BYTE_COLUMNS - size) * 3);
+  out.put("| ");
+
+  char *p = out.reserve(SeqCommand::DISASM_MAX + 1);
+  out.commit(cmd->writeDisasm(p, SeqCommand::DISASM_MAX));
+  out.put('\n');
+  return size;
+}
+
+uint32_t SeqDisassembler::writeData(DisasmWriter &out, uint32_t pc, bool bad)
+{
+  uint32_t n = 0;
+  uint32_t size = flags.size();
+  // stop at the next instruction or label so those stay aligned
+  while (n < DATA_PER_LINE && pc + n < size)
+  {
+    uint8_t f = flags[pc + n];
+    if (n > 0 && (f & (FLAG_START | FLAG_BAD | FLAG_TRACK | FLAG_CALL | FLAG_JUMP))) break;
+    n++;
+    if (bad) break; // keep the bad byte on its own line
+  }
+
+  out.hex(pc, 6);
+  out.put(" | ");
+  for (uint32_t i = 0; i < n; i++)
+  {
+    out.hex(parser.seqdata[pc + i], 2);
+    out.put(' ');
+  }
+  if (n < BYTE_COLUMNS) out.pad((BYTE_COLUMNS - n) * 3);
+
+  if (bad)
+  {
+    SeqCommand *cmd = parser.readCommand(pc, slot);
+    out.put("| ");
+    char *p = out.reserve(SeqCommand::DISASM_MAX + 1);
+    out.commit(cmd->writeDisasm(p, SeqCommand::DISASM_MAX));
+    out.put('\n');
+  }
+  else
+  {
+    out.put("| .data\n");
+  }
+  return n;
+}
+
+void SeqDisassembler::write(DisasmWriter &out)
+{
+  uint32_t size = flags.size();
+  uint32_t pc = 0;
+  while (pc < size)
+  {
+    uint8_t f = flags[pc];
+    if (f & (FLAG_TRACK | FLAG_CALL | FLAG_JUMP)) writeLabel(out, pc);
+
+    if (f & FLAG_START)
+    {
+      pc += writeInsn(out, pc);
+    }
+    else
+    {
+      pc += writeData(out, pc, (f & FLAG_BAD) != 0);
+    }
+  }
+
+  char *p = out.reserve(128);
+  out.commit(snprintf(p, 128, "\n; %u instructions, %u bad targets, %u overlaps, %u unreached bytes\n",
+                      num_insns, num_bad, num_overlaps, getUnreachedBytes()));
+}
@@ -0,0 +1,83 @@
+#ifndef SYNTH_SEQ_DISASM_H
+#define SYNTH_SEQ_DISASM_H
+
+#include "parser.h"
+
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+  Large output buffer for the disassembler. Text is appended into a fixed
+  block and only handed to stdio when the block fills up.
+*/
+class DisasmWriter
+{
+private:
+  FILE *out;
+  std::vector<char> buf;
+  size_t used = 0;
+
+public:
+  DisasmWriter(FILE *out, size_t size=1 << 20);
+  ~DisasmWriter();
+
+  // make sure at least n bytes are free; returns a pointer to the free space
+  char *reserve(size_t n);
+  void commit(size_t n) { used += n; }
+  void flush();
+
+  void put(char c);
+  void put(const char *s);
+  void hex(uint32_t v, uint32_t digits);
+  void pad(uint32_t n);
+};
+
+class SeqDisassembler
+{
+private:
+  enum
+  {
+    FLAG_CODE   = 0x01, // byte belongs to a decoded instruction
+    FLAG_START  = 0x02, // first byte of an instruction
+    FLAG_BAD    = 0x04, // reached by control flow but could not be decoded
+    FLAG_TRACK  = 0x08, // target of an open track
+    FLAG_CALL   = 0x10, // target of a call
+    FLAG_JUMP   = 0x20, // target of a jump
+    FLAG_QUEUED = 0x40
+  };
+
+  SeqParser &parser;
+  std::vector<uint8_t> flags;
+  // commands are decoded into this as they're traced and again as they're
+  // written out, rather than kept
+  SeqParser::CmdSlot slot;
+  std::vector<uint8_t> track_ids;
+  std::vector<uint32_t> worklist;
+
+  uint32_t num_insns = 0;
+  uint32_t num_bad = 0;
+  uint32_t num_overlaps = 0;
+
+  void queue(uint32_t pc, uint8_t flag);
+  void trace(uint32_t pc);
+
+  void writeLabel(DisasmWriter &out, uint32_t pc);
+  // returns the size of the instruction
+  uint32_t writeInsn(DisasmWriter &out, uint32_t pc);
+  uint32_t writeData(DisasmWriter &out, uint32_t pc, bool bad);
+
+public:
+  SeqDisassembler(SeqParser &parser);
+
+  // follow control flow from the sequence entry point (pc 0)
+  void analyze();
+  void write(DisasmWriter &out);
+
+  uint32_t getInsnCount() { return num_insns; }
+  uint32_t getBadCount() { return num_bad; }
+  uint32_t getOverlapCount() { return num_overlaps; }
+  uint32_t getUnreachedBytes();
+};
+
+#endif // SYNTH_SEQ_DISASM_H
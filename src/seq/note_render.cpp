@@ -0,0 +1,232 @@
+#include "note_render.h"
+
+#include "../worker_pool.h"
+
+#include <algorithm>
+#include <thread>
+#include <cmath>
+
+NoteRenderer::NoteRenderer(AudioSystem &system, SeqParser &parser, float samplerate)
+  : audioSys(system), parser(parser), samplerate(samplerate)
+{
+
+}
+
+void NoteRenderer::buildBlocks()
+{
+  // the same blocks SeqController::tick() would render
+  blocks.clear();
+  event_blocks.clear();
+  for (uint32_t e = 0; e + 1 < timeline.events.size(); e++)
+  {
+    event_blocks.push_back(blocks.size());
+    uint64_t pos = timeline.events[e];
+    uint64_t next = timeline.events[e + 1];
+    do
+    {
+      uint32_t length = (uint32_t)std::min<uint64_t>(next - pos, max_block);
+      blocks.push_back(Block{pos, length, e});
+      pos += length;
+    } while (pos < next);
+  }
+}
+
+const SeqTimeline::Perf &NoteRenderer::getPerf(uint32_t track, uint32_t event)
+{
+  // a track has values from the first event it ran on, before any of its notes
+  const std::vector<SeqTimeline::Perf> &perf = timeline.tracks[track];
+  std::vector<SeqTimeline::Perf>::const_iterator it = std::upper_bound(perf.begin(), perf.end(), event,
+      [](uint32_t e, const SeqTimeline::Perf &p) { return e < p.event; });
+  return *(it - 1);
+}
+
+void NoteRenderer::renderVoice(Voice &v)
+{
+  const SeqTimeline::Span &span = timeline.notes[v.span];
+  uint64_t base = blocks[window_begin].start;
+  std::fill(v.buf.begin(), v.buf.end(), 0.0);
+
+  for (uint32_t b = std::max(v.first, window_begin); b < window_end; b++)
+  {
+    const Block &block = blocks[b];
+    // releases and track closes happen as an event starts
+    if (event_blocks[block.event] == b)
+    {
+      if (block.event == span.cut_event)
+      {
+        v.gone = b;
+        return;
+      }
+      if (block.event == span.off_event) v.note.stop();
+    }
+
+    const SeqTimeline::Perf &perf = getPerf(span.track, block.event);
+    v.note.pitch_adj = perf.pitch_ratio;
+    v.note.pitch_curve = nullptr;
+    if (perf.vibrato.isActive())
+    {
+      double ticks = perf.vibrato_ticks + (block.start - timeline.events[block.event]) * perf.ticks_per_sample;
+      SeqTrack::fillPitchCurve(v.pitch_curve.data(), block.length, perf.pitch, perf.vibrato, ticks,
+                               perf.ticks_per_sample);
+      v.note.pitch_curve = v.pitch_curve.data();
+    }
+    v.note.cull_gain = SeqTrack::getCullGain(cull_db, perf.volume);
+    v.note.hold_cull_gain = SeqTrack::getCullGain(cull_db, 1);
+    v.note.render(v.buf.data() + (block.start - base), block.length, interp_mode);
+    if (v.note.isFinished())
+    {
+      v.gone = b + 1;
+      return;
+    }
+  }
+}
+
+void NoteRenderer::renderJob(void *ctx, uint32_t index, uint32_t /* worker */)
+{
+  NoteRenderer *r = static_cast<NoteRenderer *>(ctx);
+  r->renderVoice(*r->voices[index]);
+}
+
+void NoteRenderer::mixTrack(uint32_t track, stk::StkFloat *sum, stk::StkFloat *left, stk::StkFloat *right)
+{
+  TrackRamp &ramp = ramps[track];
+  uint64_t base = blocks[window_begin].start;
+  uint64_t frames = blocks[window_end - 1].start + blocks[window_end - 1].length - base;
+
+  // added up in the order the notes started, as the track would
+  std::fill(sum, sum + frames, 0.0);
+  bool any = false;
+  for (std::unique_ptr<Voice> &v : voices)
+  {
+    if (timeline.notes[v->span].track != track) continue;
+    for (uint64_t i = 0; i < frames; i++) sum[i] += v->buf[i];
+    any = true;
+  }
+  if (!any)
+  {
+    ramp.valid = false;
+    return;
+  }
+
+  // the same ramps as SeqTrack::render() and the controller's mixdown
+  for (uint32_t b = window_begin; b < window_end; b++)
+  {
+    const Block &block = blocks[b];
+    bool present = false;
+    for (std::unique_ptr<Voice> &v : voices)
+    {
+      if (timeline.notes[v->span].track == track && v->first <= b && b < v->gone) present = true;
+    }
+    if (!present)
+    {
+      ramp.valid = false;
+      continue;
+    }
+
+    const SeqTimeline::Perf &perf = getPerf(track, block.event);
+    float volume_from = ramp.valid ? ramp.volume : perf.volume;
+    float pan_from = ramp.valid ? ramp.pan : perf.pan;
+    ramp.volume = perf.volume;
+    ramp.pan = perf.pan;
+    ramp.valid = true;
+
+    uint32_t samples = block.length;
+    stk::StkFloat *buf = sum + (block.start - base);
+    stk::StkFloat dv = (perf.volume - volume_from) / samples;
+    double panL = std::sqrt(-pan_from + 1);
+    double panR = std::sqrt( pan_from);
+    double dL = (std::sqrt(-perf.pan + 1) - panL) / samples;
+    double dR = (std::sqrt( perf.pan) - panR) / samples;
+    for (uint32_t i = 0; i < samples; i++)
+    {
+      buf[i] *= volume_from + dv * (i + 1);
+      double gL = (panL + dL * (i + 1)) * volume;
+      double gR = (panR + dR * (i + 1)) * volume;
+      left[block.start - base + i] += buf[i] * gL;
+      right[block.start - base + i] += buf[i] * gR;
+    }
+  }
+}
+
+void NoteRenderer::render(stk::WvOut &out, uint32_t threads)
+{
+  if (loop_limit <= 0)
+  {
+    printf("ERROR: NoteRenderer needs a loop limit above 0; nothing rendered\n");
+    return;
+  }
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+  // loads everything the notes will need before they're rendered in parallel
+  {
+    SeqController planner(audioSys, parser, samplerate);
+    planner.loop_limit = loop_limit;
+    planner.max_block = max_block;
+    planner.cull_db = cull_db;
+    planner.quiet = true;
+    planner.plan(timeline);
+  }
+  buildBlocks();
+  ramps.assign(timeline.tracks.size(), TrackRamp());
+  voices.clear();
+
+  WorkerPool pool(threads);
+  uint32_t next_span = 0;
+  std::vector<stk::StkFloat> sum;
+  stk::StkFrames left;
+  stk::StkFrames right;
+  stk::StkFrames frames;
+
+  window_begin = 0;
+  while (window_begin < blocks.size())
+  {
+    window_end = window_begin;
+    uint64_t base = blocks[window_begin].start;
+    while (window_end < blocks.size() && blocks[window_end].start - base < WINDOW) window_end++;
+    uint64_t window_frames = blocks[window_end - 1].start + blocks[window_end - 1].length - base;
+
+    // notes starting in the window join the ones still sounding
+    while (next_span < timeline.notes.size())
+    {
+      const SeqTimeline::Span &span = timeline.notes[next_span];
+      // notes started as the sequence ended are never heard
+      if (span.on_event >= event_blocks.size() || event_blocks[span.on_event] >= window_end) break;
+      std::unique_ptr<Voice> v = std::make_unique<Voice>();
+      v->span = next_span++;
+      v->first = event_blocks[span.on_event];
+      v->gone = UINT32_MAX;
+      v->pitch_curve.resize(max_block / Note::ENV_CHUNK + 1);
+      SampleInstr instr = span.instr;
+      instr.createNote(span.key, span.vel, &v->note);
+      v->note.start();
+      voices.push_back(std::move(v));
+    }
+    for (std::unique_ptr<Voice> &v : voices)
+    {
+      if (v->buf.size() < window_frames) v->buf.resize(window_frames);
+    }
+
+    pool.run(voices.size(), &NoteRenderer::renderJob, this);
+
+    if (sum.size() < window_frames) sum.resize(window_frames);
+    left.resize(window_frames, 1, 0.0);
+    right.resize(window_frames, 1, 0.0);
+    for (uint32_t t = 0; t < timeline.tracks.size(); t++)
+    {
+      mixTrack(t, sum.data(), &left[0], &right[0]);
+    }
+    frames.resize(window_frames, 2);
+    frames.setChannel(0, left, 0);
+    frames.setChannel(1, right, 0);
+    out.tick(frames);
+
+    // notes that ended are dropped, keeping the rest in order
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < voices.size(); i++)
+    {
+      if (voices[i]->gone == UINT32_MAX) voices[kept++] = std::move(voices[i]);
+    }
+    voices.resize(kept);
+    window_begin = window_end;
+  }
+}
@@ -0,0 +1,103 @@
+#ifndef SYNTH_SEQ_NOTE_RENDER_H
+#define SYNTH_SEQ_NOTE_RENDER_H
+
+#include "track.h"
+#include "../audio_system.h"
+#include <stk/WvOut.h>
+#include <stk/Stk.h>
+#include <vector>
+#include <memory>
+
+/*
+  Offline rendering with every note played on its own. A planning pass
+  (see SeqController::plan()) lists each note with all it needs to play
+  alone: the instrument and key it was started with, the events it starts,
+  is released and is cut off on, and its track's pitch, volume and pan from
+  event to event. The song is then rendered a window of blocks at a time.
+  Each note sounding in the window renders into a buffer of its own, on
+  whichever thread is free. The buffers are added up per track in note
+  order, given the track's volume and pan ramps, and mixed down in track
+  order, so the result doesn't depend on the threads.
+
+  Notes play through Note::render() and there is no voice limit. Output
+  matches a SeqController with reference_voices set that doesn't steal
+  voices to within rounding. Tracks are summed in the order they first ran,
+  while the controller sums them in the order of their slots in its track
+  pool, so the two can differ in the last bits once a closed track's slot
+  is reused.
+*/
+class NoteRenderer
+{
+private:
+  struct Block
+  {
+    uint64_t start;
+    uint32_t length;
+    uint32_t event; // index in the timeline's events
+  };
+
+  struct Voice
+  {
+    uint32_t span;
+    Note note;
+    // block the note starts on, and the first block its track no longer
+    // has it on (UINT32_MAX while that isn't known)
+    uint32_t first;
+    uint32_t gone;
+    // the note's output over the current window
+    std::vector<stk::StkFloat> buf;
+    // its track's vibrato over the current block
+    std::vector<float> pitch_curve;
+  };
+
+  struct TrackRamp
+  {
+    float volume = 0;
+    float pan = 0.5;
+    bool valid = false;
+  };
+
+  AudioSystem &audioSys;
+  SeqParser &parser;
+  float samplerate;
+  SeqTimeline timeline;
+
+  std::vector<Block> blocks;
+  // first block of each event
+  std::vector<uint32_t> event_blocks;
+  // notes sounding in the current window, in the order they started
+  std::vector<std::unique_ptr<Voice>> voices;
+  std::vector<TrackRamp> ramps;
+  // current window, in blocks
+  uint32_t window_begin = 0;
+  uint32_t window_end = 0;
+
+  void buildBlocks();
+  const SeqTimeline::Perf &getPerf(uint32_t track, uint32_t event);
+  void renderVoice(Voice &v);
+  static void renderJob(void *ctx, uint32_t index, uint32_t worker);
+  // adds track's notes into left/right with its volume and pan
+  void mixTrack(uint32_t track, stk::StkFloat *sum, stk::StkFloat *left, stk::StkFloat *right);
+
+public:
+  NoteRenderer(AudioSystem &system, SeqParser &parser, float samplerate);
+
+  // as on SeqController
+  int loop_limit = 2;
+  double volume = 1.0;
+  uint32_t max_block = 8192;
+  Interpolator::Mode interp_mode = Interpolator::LINEAR;
+  double cull_db = -96.0;
+
+  // samples rendered per batch of note jobs, at least
+  static const uint32_t WINDOW = 4096;
+
+  // render the sequence into out on this many threads (0 for one per core).
+  // the sequence has to end, so loop_limit must be above 0
+  void render(stk::WvOut &out, uint32_t threads);
+
+  uint64_t getLength() { return timeline.length; }
+  uint32_t getNumNotes() { return timeline.notes.size(); }
+};
+
+#endif // SYNTH_SEQ_NOTE_RENDER_H
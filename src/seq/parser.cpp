@@ -10,11 +10,45 @@ void SeqParser::load(std::istream &f, uint32_t cmdset)
   f.read((char *)(this->seqdata.data()), size);
 }
 
+namespace
+{
+
+struct HeapCmd
+{
+  std::unique_ptr<SeqCommand> cmd;
+
+  template <typename T>
+  SeqCommand *operator()(const T &c)
+  {
+    cmd = std::make_unique<T>(c);
+    return cmd.get();
+  }
+};
+
+} // namespace
+
 std::unique_ptr<SeqCommand> SeqParser::readCommand(uint32_t pc)
 {
-  if (pc >= seqdata.size()) return std::make_unique<BadCmd>(BadCmd(0, BadCmd::ERR_EOF));
+  HeapCmd alloc;
+  decode(pc, alloc);
+  return std::move(alloc.cmd);
+}
+
+SeqCommand *SeqParser::readCommand(uint32_t pc, CmdSlot &slot)
+{
+  return decode(pc, slot);
+}
+
+/*
+  Alloc is called with each command to create and returns where it was put;
+  creating another command replaces the previous one.
+*/
+template <typename Alloc>
+SeqCommand *SeqParser::decode(uint32_t pc, Alloc &alloc)
+{
+  if (pc >= seqdata.size()) return alloc(BadCmd(0, BadCmd::ERR_EOF));
   uint8_t opcode = seqdata[pc];
-  std::unique_ptr<SeqCommand> cmd;
+  SeqCommand *cmd;
 
   //////////////////////////////////////////////
   // OPCODE TABLE
@@ -30,72 +64,75 @@ std::unique_ptr<SeqCommand> SeqParser::readCommand(uint32_t pc)
   // * CmdJump [c] : 0xC3
   // * CmdReturn   : 0xC5
   // * CmdJump [j] : 0xC7
+  // * CmdVibrato  : 0xE6
+  // * CmdVibrato  : 0xF4
   // * CmdTimebase : 0xFD
   // * CmdTempo    : 0xFE
   // * CmdTrackEnd : 0xFF
 
   if (opcode < 0x80)
-    cmd = std::make_unique<CmdNoteOn>(CmdNoteOn());
+    cmd = alloc(CmdNoteOn());
   else if (opcode == 0x80)
-    cmd = std::make_unique<CmdWait>(CmdWait());
+    cmd = alloc(CmdWait());
   else if (opcode < 0x88)
-    cmd = std::make_unique<CmdVoiceOff>(CmdVoiceOff());
+    cmd = alloc(CmdVoiceOff());
   else if (opcode == 0x88)
-    cmd = std::make_unique<CmdWait>(CmdWait());
+    cmd = alloc(CmdWait());
   else if (opcode == 0x94 || opcode == 0x98)
-    cmd = std::make_unique<CmdSetPerf>(CmdSetPerf(3));
+    cmd = alloc(CmdSetPerf(3));
   else if (opcode == 0x96 || opcode == 0x9A || opcode == 0x9C)
-    cmd = std::make_unique<CmdSetPerf>(CmdSetPerf(4));
+    cmd = alloc(CmdSetPerf(4));
   else if (opcode == 0x97 || opcode == 0x9B || opcode == 0x9E)
-    cmd = std::make_unique<CmdSetPerf>(CmdSetPerf(5));
+    cmd = alloc(CmdSetPerf(5));
   else if (opcode == 0x9F)
-    cmd = std::make_unique<CmdSetPerf>(CmdSetPerf(6));
+    cmd = alloc(CmdSetPerf(6));
   else if (opcode == 0xA4)
-    cmd = std::make_unique<CmdSetParam>(CmdSetParam(false));
+    cmd = alloc(CmdSetParam(false));
   else if (opcode == 0xAC)
-    cmd = std::make_unique<CmdSetParam>(CmdSetParam(true));
+    cmd = alloc(CmdSetParam(true));
   else if (opcode == 0xC1)
-    cmd = std::make_unique<CmdOpenTrack>(CmdOpenTrack());
+    cmd = alloc(CmdOpenTrack());
   else if (opcode == 0xC3)
-    cmd = std::make_unique<CmdJump>(CmdJump(true));
+    cmd = alloc(CmdJump(true));
   else if (opcode == 0xC4)
-    cmd = std::make_unique<CmdJumpF>(CmdJumpF(true));
+    cmd = alloc(CmdJumpF(true));
   else if (opcode == 0xC5)
-    cmd = std::make_unique<CmdReturn>(CmdReturn());
+    cmd = alloc(CmdReturn());
   else if (opcode == 0xC6)
-    cmd = std::make_unique<CmdReturnF>(CmdReturnF());
+    cmd = alloc(CmdReturnF());
   else if (opcode == 0xC7)
-    cmd = std::make_unique<CmdJump>(CmdJump(false));
+    cmd = alloc(CmdJump(false));
   else if (opcode == 0xC8)
-    cmd = std::make_unique<CmdJumpF>(CmdJumpF(false));
+    cmd = alloc(CmdJumpF(false));
   else if (opcode == 0xCB)
-    cmd = std::make_unique<CmdIDontCare>(CmdIDontCare("loop start?", 3));
+    cmd = alloc(CmdIDontCare("loop start?", 3));
   else if (opcode == 0xCC)
-    cmd = std::make_unique<CmdIDontCare>(CmdIDontCare("loop end?", 3));
+    cmd = alloc(CmdIDontCare("loop end?", 3));
   else if (opcode == 0xE6)
-    cmd = std::make_unique<CmdIDontCare>(CmdIDontCare("vibrato", 3));
+    cmd = alloc(CmdVibrato(false));
   else if (opcode == 0xE7)
-    cmd = std::make_unique<CmdIDontCare>(CmdIDontCare("sync cpu", 3));
+    cmd = alloc(CmdIDontCare("sync cpu", 3));
   else if (opcode == 0xF4)
-    cmd = std::make_unique<CmdIDontCare>(CmdIDontCare("vibrato pitch", 2));
+    cmd = alloc(CmdVibrato(true));
   else if (opcode == 0xFD)
-    cmd = std::make_unique<CmdTempo>(CmdTempo());
+    cmd = alloc(CmdTempo());
   else if (opcode == 0xFE)
-    cmd = std::make_unique<CmdTimebase>(CmdTimebase());
+    cmd = alloc(CmdTimebase());
   else if (opcode == 0xFF)
-    cmd = std::make_unique<CmdTrackEnd>(CmdTrackEnd());
+    cmd = alloc(CmdTrackEnd());
   else
-    return std::make_unique<BadCmd>(BadCmd(1, BadCmd::ERR_INVALID_OPCODE));
+    return alloc(BadCmd(1, BadCmd::ERR_INVALID_OPCODE));
 
-  if (pc + cmd->getSize() > seqdata.size())
+  uint32_t size = cmd->getSize();
+  if (pc + size > seqdata.size())
   {
-    return std::make_unique<BadCmd>(BadCmd(cmd->getSize(), BadCmd::ERR_EOF));
+    return alloc(BadCmd(size, BadCmd::ERR_EOF));
   }
 
   uint32_t status = cmd->read(seqdata, pc);
   if (status != 0)
   {
-    return std::make_unique<BadCmd>(BadCmd(cmd->getSize(), status));
+    return alloc(BadCmd(cmd->getSize(), status));
   }
 
   return cmd;
@@ -6,6 +6,9 @@
 #include <istream>
 #include <string>
 #include <memory>
+#include <new>
+#include <stdarg.h>
+#include <stdio.h>
 
 class SeqCommand
 {
@@ -13,6 +16,7 @@ protected:
   uint32_t size = 0;
 public:
   SeqCommand(uint32_t size) : size(size) {}
+  virtual ~SeqCommand() {}
 
   virtual uint32_t read(std::vector<unsigned char> &data, uint32_t off) = 0;
 
@@ -21,8 +25,34 @@ public:
   virtual uint8_t getParamWidth(uint8_t p) = 0;
   virtual void setParam(uint8_t p, uint32_t v) = 0;
 
-  virtual std::string getDisasm() = 0;
+  /*
+    Writes the disassembly text into buf (always NUL-terminated) and returns
+    the number of characters written, excluding the terminator.
+  */
+  virtual uint32_t writeDisasm(char *buf, uint32_t len) = 0;
   uint32_t getSize() {return size;}
+
+  std::string getDisasm()
+  {
+    char buf[DISASM_MAX];
+    writeDisasm(buf, DISASM_MAX);
+    return std::string(buf);
+  }
+
+  static const uint32_t DISASM_MAX = 96;
+
+protected:
+  static uint32_t formatDisasm(char *buf, uint32_t len, const char *fmt, ...)
+  {
+    if (len == 0) return 0;
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf, len, fmt, args);
+    va_end(args);
+    if (n < 0) n = 0;
+    if ((uint32_t)n >= len) n = len - 1;
+    return n;
+  }
 };
 
 class BadCmd : public SeqCommand
@@ -43,7 +73,12 @@ public:
   uint8_t getParamCount() override {return 0;}
   uint8_t getParamWidth(uint8_t p) override {return 0;}
   void setParam(uint8_t p, uint32_t v) override {}
-  std::string getDisasm() override {return "[invalid]";}
+  uint32_t writeDisasm(char *buf, uint32_t len) override
+  {
+    if (errcode == ERR_EOF) return formatDisasm(buf, len, "[invalid: eof]");
+    else if (errcode == ERR_INVALID_OPCODE) return formatDisasm(buf, len, "[invalid: opcode]");
+    else return formatDisasm(buf, len, "[invalid: data]");
+  }
 
   uint32_t getError() {return errcode;}
 };
@@ -51,16 +86,19 @@ public:
 class CmdIDontCare : public SeqCommand
 {
 private:
-  const std::string msg;
+  const char *msg;
 public:
-  CmdIDontCare(const std::string msg, uint32_t size)
+  CmdIDontCare(const char *msg, uint32_t size)
     : msg(msg), SeqCommand(size) {}
 
   uint32_t read(std::vector<unsigned char> &data, uint32_t off) override { return 0; }
   uint8_t getParamCount() override {return 0;}
   uint8_t getParamWidth(uint8_t p) override {return 0;}
   void setParam(uint8_t p, uint32_t v) override {}
-  std::string getDisasm() override {return msg;}
+  uint32_t writeDisasm(char *buf, uint32_t len) override
+  {
+    return formatDisasm(buf, len, "%s", msg);
+  }
 };
 
 class SeqParser
@@ -68,7 +106,43 @@ class SeqParser
 private:
   uint32_t cmdset;
 
+  template <typename Alloc>
+  SeqCommand *decode(uint32_t pc, Alloc &alloc);
+
 public:
+  /*
+    Storage for a single decoded command, so the sequence VM can decode
+    without touching the heap. The command is valid until the slot is reused.
+  */
+  class CmdSlot
+  {
+  private:
+    alignas(8) unsigned char storage[48];
+    SeqCommand *cmd = nullptr;
+
+  public:
+    CmdSlot() {}
+    // the command lives in storage, so a copy would point into the original
+    CmdSlot(const CmdSlot &) = delete;
+    CmdSlot &operator=(const CmdSlot &) = delete;
+    ~CmdSlot() { clear(); }
+
+    void clear()
+    {
+      if (cmd != nullptr) cmd->~SeqCommand();
+      cmd = nullptr;
+    }
+
+    template <typename T>
+    SeqCommand *operator()(const T &c)
+    {
+      static_assert(sizeof(T) <= sizeof(storage), "command does not fit in CmdSlot");
+      clear();
+      cmd = new (storage) T(c);
+      return cmd;
+    }
+  };
+
   std::vector<unsigned char> seqdata;
   enum CmdSet
   {
@@ -90,6 +164,7 @@ public:
 
   void load(std::istream &f, uint32_t cmdset=JAUDIO_1);
   std::unique_ptr<SeqCommand> readCommand(uint32_t pc);
+  SeqCommand *readCommand(uint32_t pc, CmdSlot &slot);
 };
 
 /////////////////////////////////////////////////////////////////////////////////////
@@ -162,9 +237,9 @@ public:
     else if (p == 1) vel = v;
   }
 
-  std::string getDisasm() override
+  uint32_t writeDisasm(char *buf, uint32_t len) override
   {
-    return "note " + std::to_string(note) + " voice=" + std::to_string(voice) + " vel=" + std::to_string(vel);
+    return formatDisasm(buf, len, "note %u voice=%u vel=%u", note, voice, vel);
   }
 
   uint8_t getNote() { return note; }
@@ -195,9 +270,9 @@ public:
   uint8_t getParamWidth(uint8_t p) override { return 0; }
   void setParam(uint8_t p, uint32_t v) override {}
 
-  std::string getDisasm() override
+  uint32_t writeDisasm(char *buf, uint32_t len) override
   {
-    return "voice off " + std::to_string(voice);
+    return formatDisasm(buf, len, "voice off %u", voice);
   }
 
   uint8_t getVoice() { return voice; }
@@ -259,9 +334,9 @@ public:
   uint8_t getParamWidth(uint8_t p) override { return 0; }
   void setParam(uint8_t p, uint32_t v) override {}
 
-  std::string getDisasm() override
+  uint32_t writeDisasm(char *buf, uint32_t len) override
   {
-    return "delay " + std::to_string(delay);
+    return formatDisasm(buf, len, "delay %u", delay);
   }
 
   uint32_t getDelay() { return delay; }
@@ -299,12 +374,9 @@ public:
     else if (p == 1) offset = v;
   }
 
-  std::string getDisasm() override
+  uint32_t writeDisasm(char *buf, uint32_t len) override
   {
-    char hex[8];
-    snprintf(hex, 7, "%06x", offset);
-    hex[7] = 0;
-    return "open track " + std::to_string(trackn) + " @ " + std::string(hex);
+    return formatDisasm(buf, len, "open track %u @ %06x", trackn, offset);
   }
 
   uint8_t getTrackID() { return trackn; }
@@ -328,9 +400,9 @@ public:
   uint8_t getParamWidth(uint8_t p) override { return 0; }
   void setParam(uint8_t p, uint32_t v) override {}
 
-  std::string getDisasm() override
+  uint32_t writeDisasm(char *buf, uint32_t len) override
   {
-    return "track end";
+    return formatDisasm(buf, len, "track end");
   }
 };
 
@@ -406,9 +478,9 @@ public:
   uint8_t getParamWidth(uint8_t p) override { return 0; }
   void setParam(uint8_t p, uint32_t v) override {}
 
-  std::string getDisasm() override
+  uint32_t writeDisasm(char *buf, uint32_t len) override
   {
-    return "set perf " + std::to_string(type) + " -> " + std::to_string(value) + " over " + std::to_string(duration) + " ticks";
+    return formatDisasm(buf, len, "set perf %u -> %d over %u ticks", type, value, duration);
   }
 
   uint8_t getType() { return type; }
@@ -440,9 +512,9 @@ public:
     if (p == 0) tempo = v;
   }
 
-  std::string getDisasm() override
+  uint32_t writeDisasm(char *buf, uint32_t len) override
   {
-    return "tempo " + std::to_string(tempo);
+    return formatDisasm(buf, len, "tempo %u", tempo);
   }
 
   uint16_t getTempo() { return tempo; }
@@ -471,14 +543,52 @@ public:
     timebase = v;
   }
 
-  std::string getDisasm() override
+  uint32_t writeDisasm(char *buf, uint32_t len) override
   {
-    return "timebase " + std::to_string(timebase);
+    return formatDisasm(buf, len, "timebase %u", timebase);
   }
 
   uint16_t getTimebase() { return timebase; }
 };
 
+/*
+  Vibrato rate : 0xE6 <rate:u16>
+  Vibrato depth: 0xF4 <depth:u8>
+  -> rate is taken as the LFO phase step per tick, in 1/65536 of a cycle
+  -> depth is in the same units as an 8-bit pitch perf (127 = 6 semitones)
+  Neither scale has been checked against the game yet.
+*/
+class CmdVibrato : public SeqCommand
+{
+private:
+  uint16_t value = 0;
+  bool depth;
+public:
+  CmdVibrato(bool depth) : SeqCommand(depth ? 2 : 3), depth(depth) {}
+
+  uint32_t read(std::vector<unsigned char> &data, uint32_t off) override
+  {
+    if (depth) value = data[off+1];
+    else       value = (data[off+1] << 8) | data[off+2];
+    return 0;
+  }
+
+  uint8_t getParamCount() override { return 1; }
+  uint8_t getParamWidth(uint8_t p) override { return depth ? 1 : 2; }
+  void setParam(uint8_t p, uint32_t v) override
+  {
+    value = v;
+  }
+
+  uint32_t writeDisasm(char *buf, uint32_t len) override
+  {
+    return formatDisasm(buf, len, "vibrato %s %u", depth ? "depth" : "rate", value);
+  }
+
+  uint16_t getValue() { return value; }
+  bool isDepth() { return depth; }
+};
+
 /*
   Jump: 0xC7
   Call: 0xC3
@@ -505,12 +615,12 @@ public:
     offset = v;
   }
 
-  std::string getDisasm() override
+  uint32_t writeDisasm(char *buf, uint32_t len) override
   {
-    return "jump " + std::to_string(offset);
+    return formatDisasm(buf, len, "%s %06x", doCall ? "call" : "jump", offset);
   }
 
-  uint16_t getTarget() { return offset; }
+  uint32_t getTarget() { return offset; }
   bool isCall() { return doCall; }
 };
 
@@ -542,12 +652,12 @@ public:
     offset = v;
   }
 
-  std::string getDisasm() override
+  uint32_t writeDisasm(char *buf, uint32_t len) override
   {
-    return "jump " + std::to_string(offset);
+    return formatDisasm(buf, len, "%s cond=%u %06x", doCall ? "callF" : "jumpF", cond, offset);
   }
 
-  uint16_t getTarget() { return offset; }
+  uint32_t getTarget() { return offset; }
   bool isCall() { return doCall; }
 };
 
@@ -569,9 +679,9 @@ public:
   uint8_t getParamWidth(uint8_t p) override { return 0; }
   void setParam(uint8_t p, uint32_t v) override {}
 
-  std::string getDisasm() override
+  uint32_t writeDisasm(char *buf, uint32_t len) override
   {
-    return "return";
+    return formatDisasm(buf, len, "return");
   }
 
 };
@@ -590,9 +700,9 @@ public:
   uint8_t getParamWidth(uint8_t p) override { return 0; }
   void setParam(uint8_t p, uint32_t v) override {}
 
-  std::string getDisasm() override
+  uint32_t writeDisasm(char *buf, uint32_t len) override
   {
-    return "returnF";
+    return formatDisasm(buf, len, "returnF");
   }
 
 };
@@ -632,9 +742,9 @@ public:
     else if (p == 1) this->v = v;
   }
 
-  std::string getDisasm() override
+  uint32_t writeDisasm(char *buf, uint32_t len) override
   {
-    return "set param " + std::to_string(type) + " -> " + std::to_string(v);
+    return formatDisasm(buf, len, "set param %u -> %u", type, v);
   }
 
   uint8_t getType() { return type; }
@@ -0,0 +1,161 @@
+#include "segment_render.h"
+
+#include "../worker_pool.h"
+
+#include <algorithm>
+#include <thread>
+
+// keeps the frames of a controller's output that fall in one segment
+class SegmentOut : public stk::WvOut
+{
+private:
+  stk::StkFrames &frames;
+  uint64_t pos;
+  uint64_t start;
+
+public:
+  SegmentOut(stk::StkFrames &frames, uint64_t pos, uint64_t start)
+    : frames(frames), pos(pos), start(start) {}
+
+  void tick(const stk::StkFloat sample) override
+  {
+    if (pos >= start && pos - start < frames.frames())
+    {
+      frames(pos - start, 0) = sample;
+      frames(pos - start, 1) = sample;
+    }
+    pos++;
+  }
+
+  void tick(const stk::StkFrames &data) override
+  {
+    for (uint32_t i = 0; i < data.frames(); i++)
+    {
+      if (pos >= start && pos - start < frames.frames())
+      {
+        frames(pos - start, 0) = data(i, 0);
+        frames(pos - start, 1) = data(i, 1);
+      }
+      pos++;
+    }
+  }
+};
+
+SegmentRenderer::SegmentRenderer(AudioSystem &system, SeqParser &parser, float samplerate)
+  : audioSys(system), parser(parser), samplerate(samplerate)
+{
+
+}
+
+void SegmentRenderer::configure(SeqController &c)
+{
+  c.loop_limit = loop_limit;
+  c.volume = volume;
+  c.max_block = max_block;
+  c.reference_voices = reference_voices;
+  c.interp_mode = interp_mode;
+  c.cull_db = cull_db;
+  c.quiet = true;
+}
+
+uint64_t SegmentRenderer::findWarmup(uint64_t start)
+{
+  if (start == 0) return 0;
+  // rendering from the event before the segment (and not just the start of
+  // it) gives the tracks' volume and pan ramps a block to settle
+  std::vector<uint64_t>::iterator it = std::lower_bound(timeline.events.begin(), timeline.events.end(), start);
+  uint64_t from = *(it - 1);
+  uint64_t warmup = from;
+  for (const SeqTimeline::Span &span : timeline.notes)
+  {
+    if (span.start < from && span.end >= from) warmup = std::min(warmup, span.start);
+  }
+  return warmup;
+}
+
+void SegmentRenderer::renderSegment(Segment &seg)
+{
+  AudioSystem voices(audioSys, audioSys.getPolyphony());
+  voices.steal_policy = audioSys.steal_policy;
+  SeqController c(voices, parser, samplerate);
+  configure(c);
+
+  seg.frames.resize(seg.end - seg.start, 2, 0.0);
+  SegmentOut out(seg.frames, seg.warmup, seg.start);
+  c.skipTo(seg.warmup);
+  while (c.getSamplesProcessed() < seg.end)
+  {
+    if (!c.tick(out)) break;
+  }
+  seg.stolen = voices.getNumStolen();
+}
+
+void SegmentRenderer::renderJob(void *ctx, uint32_t index, uint32_t /* worker */)
+{
+  SegmentRenderer *r = static_cast<SegmentRenderer *>(ctx);
+  r->renderSegment(r->segments[index]);
+}
+
+void SegmentRenderer::render(stk::WvOut &out, uint32_t threads, uint32_t count)
+{
+  if (loop_limit <= 0)
+  {
+    printf("ERROR: SegmentRenderer needs a loop limit above 0; nothing rendered\n");
+    return;
+  }
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  if (count == 0) count = threads * 4;
+
+  // this also loads every bank and wave system the sequence uses, and builds
+  // its envelope curves, before the segments share them
+  {
+    SeqController planner(audioSys, parser, samplerate);
+    configure(planner);
+    planner.plan(timeline);
+  }
+
+  segments.clear();
+  uint64_t start = 0;
+  for (uint32_t k = 1; k <= count; k++)
+  {
+    // blocks start on events, so segments have to as well
+    uint64_t end = timeline.length;
+    if (k < count)
+    {
+      uint64_t target = timeline.length * k / count;
+      end = *std::lower_bound(timeline.events.begin(), timeline.events.end(), target);
+    }
+    if (end <= start) continue;
+
+    Segment seg;
+    seg.start = start;
+    seg.end = end;
+    seg.warmup = findWarmup(start);
+    seg.stolen = 0;
+    segments.push_back(seg);
+    start = end;
+  }
+
+  WorkerPool pool(threads);
+  pool.run(segments.size(), &SegmentRenderer::renderJob, this);
+
+  for (Segment &seg : segments)
+  {
+    if (seg.stolen > 0)
+    {
+      printf("WARN: %llu voices stolen in segment at %llu; output may differ from a single-threaded render\n",
+             (unsigned long long)seg.stolen, (unsigned long long)seg.start);
+    }
+    out.tick(seg.frames);
+  }
+}
+
+uint64_t SegmentRenderer::getWarmupSamples()
+{
+  uint64_t total = 0;
+  for (Segment &seg : segments)
+  {
+    total += seg.start - seg.warmup;
+  }
+  return total;
+}
@@ -0,0 +1,71 @@
+#ifndef SYNTH_SEQ_SEGMENT_RENDER_H
+#define SYNTH_SEQ_SEGMENT_RENDER_H
+
+#include "track.h"
+#include "../audio_system.h"
+#include <stk/WvOut.h>
+#include <stk/Stk.h>
+#include <vector>
+
+/*
+  Offline rendering of a whole sequence in time segments, each on its own
+  thread. A planning pass runs the sequence without audio (see
+  SeqController::plan()) to find where its events and notes fall. Every
+  segment then gets a controller and voice pool of its own. It runs the
+  sequence silently up to the first note that could still be sounding when
+  the segment starts, renders from there so those voices are in the state
+  they'd be in, and keeps the part that falls in the segment. The segments
+  are written out in order once they're all done.
+
+  The output matches a plain SeqController run as long as neither has to
+  steal voices. Notes that hold until they're released can make the lead-in
+  to a segment long; getWarmupSamples() says how much extra was rendered.
+*/
+class SegmentRenderer
+{
+private:
+  struct Segment
+  {
+    // samples kept, and where rendering starts
+    uint64_t start;
+    uint64_t end;
+    uint64_t warmup;
+    stk::StkFrames frames;
+    uint64_t stolen;
+  };
+
+  AudioSystem &audioSys;
+  SeqParser &parser;
+  float samplerate;
+  SeqTimeline timeline;
+  std::vector<Segment> segments;
+
+  void configure(SeqController &c);
+  // earliest event a segment starting at `start` has to render from
+  uint64_t findWarmup(uint64_t start);
+  void renderSegment(Segment &seg);
+  static void renderJob(void *ctx, uint32_t index, uint32_t worker);
+
+public:
+  SegmentRenderer(AudioSystem &system, SeqParser &parser, float samplerate);
+
+  // as on SeqController
+  int loop_limit = 2;
+  double volume = 1.0;
+  uint32_t max_block = 8192;
+  bool reference_voices = false;
+  Interpolator::Mode interp_mode = Interpolator::LINEAR;
+  double cull_db = -96.0;
+
+  // render the sequence into out on this many threads (0 for one per core),
+  // split into `count` segments (0 for a few per thread). the sequence has
+  // to end, so loop_limit must be above 0
+  void render(stk::WvOut &out, uint32_t threads, uint32_t count = 0);
+
+  uint64_t getLength() { return timeline.length; }
+  uint32_t getNumSegments() { return segments.size(); }
+  // samples rendered only to bring voices up to the start of a segment
+  uint64_t getWarmupSamples();
+};
+
+#endif // SYNTH_SEQ_SEGMENT_RENDER_H
@@ -1,84 +1,236 @@
 #include "track.h"
 
+#include "../alloc_count.h"
+
 #include <memory>
 #include <cmath>
+#include <algorithm>
+#include <cassert>
 
 #define SEQ_PRINT_INFO
 
 SeqController::SeqController(AudioSystem &sys, SeqParser &parser, float samplerate)
   : audioSys(sys), parser(parser), samplerate(samplerate)
 {
+  newTracks.reserve(MAX_TRACKS);
+  oldTracks.reserve(MAX_TRACKS);
+  render_jobs.reserve(MAX_TRACKS);
+  spare_storage.reserve(MAX_TRACKS);
+  std::vector<ScheduledTrack> queue;
+  queue.reserve(MAX_TRACKS);
+  schedule = std::priority_queue<ScheduledTrack, std::vector<ScheduledTrack>,
+                                 std::greater<ScheduledTrack>>(std::greater<ScheduledTrack>(), std::move(queue));
+  setRenderThreads(1);
+  audioSys.addSampleRate(samplerate);
   addTrack(255, 0);
 }
 
 void SeqController::addTrack(uint8_t id, uint32_t off)
 {
-  newTracks.push_back(SeqTrack(this, &parser, off, id, samplerate));
+  TrackHandle h = tracks.add(this, &parser, off, id, samplerate);
+  if (!h.isValid())
+  {
+    printf("WARN: Too many open tracks; track %u @ %06x not opened\n", id, off);
+    return;
+  }
+  newTracks.push_back(h);
+}
+
+void SeqController::takeTrackStorage(TrackStorage &store)
+{
+  if (!spare_storage.empty())
+  {
+    store = std::move(spare_storage.back());
+    spare_storage.pop_back();
+    return;
+  }
+  // a track can't hold more notes than the voice pool has
+  store.notes.reserve(audioSys.getPolyphony());
+  store.slides.reserve(Slide::NUM_TYPES);
+  store.live.reserve(audioSys.getPolyphony());
+  for (int i = 0; i < 7; i++)
+  {
+    store.voices[i].reserve(audioSys.getPolyphony());
+  }
+  store.output = std::make_unique<stk::StkFrames>(max_block, 1);
+  store.pitch_curve.reserve(max_block / Note::ENV_CHUNK + 1);
+}
+
+void SeqController::giveTrackStorage(TrackStorage &store)
+{
+  spare_storage.push_back(std::move(store));
+}
+
+void SeqController::setRenderThreads(uint32_t threads)
+{
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  mixers.clear();
+  for (uint32_t i = 0; i < threads; i++)
+  {
+    mixers.push_back(std::make_unique<VoiceMixer>(audioSys.getPolyphony()));
+  }
+  workers = std::make_unique<WorkerPool>(threads);
+}
+
+void SeqController::renderJob(void *ctx, uint32_t index, uint32_t worker)
+{
+  SeqController *c = static_cast<SeqController *>(ctx);
+  VoiceMixer *mixer = c->reference_voices ? nullptr : c->mixers[worker].get();
+  c->render_jobs[index]->render(c->render_samples, mixer);
 }
 
 void SeqController::removeTrack(SeqTrack *t)
 {
   if (t == nullptr) return;
-  oldTracks.push_back(t);
+  t->setFinished(); // drops out of the schedule
+  oldTracks.push_back(tracks.handleOf(t));
 }
 
-uint32_t SeqController::getSamplesPerTick()
+double SeqController::getSamplesPerTick()
 {
+  if (tempo == 0 || timebase == 0) return 0;
   return (samplerate * 60.0) / ((double)tempo * timebase);
 }
 
-bool SeqController::tick(stk::WvOut &out)
+uint64_t SeqController::getTickLength()
 {
-  std::chrono::time_point proc_start = std::chrono::steady_clock::now();
+  return (uint64_t)std::llround(getSamplesPerTick() * TICK_FX_ONE);
+}
 
-  for (SeqTrack* &t : oldTracks)
+uint32_t SeqController::getNextEventTick()
+{
+  // tracks opened this tick (and tails of a finished sequence) run on the next one
+  if (!newTracks.empty() || schedule.empty()) return tick_count + 1;
+  return schedule.top().tick;
+}
+
+bool SeqController::updateTracks()
+{
+  for (TrackHandle &h : oldTracks)
   {
-    tracks.remove(*t);
+    tracks.remove(h); // stale handles are ignored
   }
-  for (SeqTrack &t : newTracks)
+  for (TrackHandle &h : newTracks)
   {
-    tracks.push_back(t);
-    printf("-> New track %p @ %06x\n", &tracks.back(), tracks.back().getPC());
+    SeqTrack *t = tracks.get(h);
+    if (t == nullptr) continue;
+    schedule.push(ScheduledTrack{tick_count, next_order++, h});
+    if (!quiet) printf("-> New track %p @ %06x\n", t, t->getPC());
   }
   newTracks.clear();
   oldTracks.clear();
 
   if (tracks.size() == 0)
   {
-    printf("Track list empty\n");
+    if (!quiet) printf("Track list empty\n");
     return false;
   }
 
+  // only tracks whose wait has expired are visited
+  while (!schedule.empty() && schedule.top().tick <= tick_count)
+  {
+    ScheduledTrack entry = schedule.top();
+    schedule.pop();
+
+    SeqTrack *t = tracks.get(entry.track);
+    if (t == nullptr) continue;
+
+    if (!t->update(tick_count)) return false;
+    if (!t->isFinished())
+    {
+      entry.tick = t->getNextTick(tick_count);
+      schedule.push(entry);
+    }
+  }
+  return true;
+}
+
+bool SeqController::tick(stk::WvOut &out)
+{
+  std::chrono::time_point proc_start = std::chrono::steady_clock::now();
+  uint64_t allocs_start = getAllocCount();
+
+  if (block_samples_left == 0 && !beginBlock()) return false;
+  if (loop_mode == LOOP_PLAYING)
+  {
+    playLoop();
+    countAllocs(allocs_start);
+    out.tick(outBuf);
+    return true;
+  }
+
+  uint32_t samples = std::min(block_samples_left, max_block);
+
+  // all buffers are sized for max_block up front; resizing below that
+  // does not reallocate
+  if (tickBufL.frames() < max_block)
+  {
+    tickBufL.resize(max_block, 1, 0);
+    tickBufR.resize(max_block, 1, 0);
+    outBuf.resize(max_block, 2, 0);
+  }
+
   // clear buffer data
-  tickBufL.resize(tickBufL.frames(), 1, 0);
-  tickBufR.resize(tickBufL.frames(), 1, 0);
-  uint32_t dataSize = 0;
+  tickBufL.resize(samples, 1, 0);
+  tickBufR.resize(samples, 1, 0);
+
+  // tracks render in parallel, each into its own buffer. the busiest go
+  // first so they don't end up last on an otherwise idle pool
+  render_jobs.clear();
+  for (SeqTrack &t : tracks)
+  {
+    render_jobs.push_back(&t);
+  }
+  std::sort(render_jobs.begin(), render_jobs.end(),
+            [](SeqTrack *a, SeqTrack *b) { return a->getNumNotes() > b->getNumNotes(); });
+  render_samples = samples;
+  workers->run(render_jobs.size(), &SeqController::renderJob, this);
 
+  // mixed down in track order, so the result doesn't depend on which thread
+  // rendered what
   for (SeqTrack &t : tracks)
   {
     // if (t.getTrackID() != 255 && t.getTrackID() != 5) continue;
-    stk::StkFrames trackData;
-    if (!t.tick(trackData)) return false;
-    
-    double panL = std::sqrt(-t.getPan() + 1);
-    double panR = std::sqrt( t.getPan());
+    bool rendered = t.getNumNotes() > 0;
+    t.releaseNotes();
+    // silent tracks have nothing to mix in
+    if (!rendered) continue;
+    const stk::StkFrames &trackBuf = t.getOutput();
 
-    if (trackData.frames() != tickBufL.frames())
-    {
-      tickBufL.resize(trackData.frames(), 1, 0);
-      tickBufR.resize(trackData.frames(), 1, 0);
-    }
-    
-    for (uint32_t i = 0; i < trackData.frames(); i++)
+    // pan gains ramp over the block, like the track volume
+    double panL = std::sqrt(-t.getPanFrom() + 1);
+    double panR = std::sqrt( t.getPanFrom());
+    double dL = (std::sqrt(-t.getPan() + 1) - panL) / samples;
+    double dR = (std::sqrt( t.getPan()) - panR) / samples;
+
+    for (uint32_t i = 0; i < samples; i++)
     {
-      tickBufL[i] += trackData[i] * panL * volume;
-      tickBufR[i] += trackData[i] * panR * volume;
+      double gL = (panL + dL * (i + 1)) * volume;
+      double gR = (panR + dR * (i + 1)) * volume;
+      tickBufL[i] += trackBuf[i] * gL;
+      tickBufR[i] += trackBuf[i] * gR;
     }
   }
-  stk::StkFrames outData(tickBufL.frames(), 2);
+  stk::StkFrames &outData = outBuf;
+  outData.resize(samples, 2);
   outData.setChannel(0, tickBufL, 0);
   outData.setChannel(1, tickBufR, 0);
 
+  // running past the room reserved means it isn't coming round again
+  if (loop_mode == LOOP_RECORDING && loop_audio.size() + samples * 2 > loop_audio.capacity())
+  {
+    loop_mode = LOOP_SEARCHING;
+    loop_audio.clear();
+  }
+  if (loop_mode == LOOP_RECORDING)
+  {
+    for (uint32_t i = 0; i < samples; i++)
+    {
+      loop_audio.push_back((float)outData(i, 0));
+      loop_audio.push_back((float)outData(i, 1));
+    }
+  }
+
   std::chrono::time_point proc_end = std::chrono::steady_clock::now();
   float proc_t = (proc_end - proc_start).count() / 1e9f;
   tick_time_tmp += proc_t;
@@ -89,15 +241,16 @@ bool SeqController::tick(stk::WvOut &out)
     tick_time_tmp = 0;
   }
 
-  out.tick(outData);
 #ifdef SEQ_PRINT_INFO
 
-  if (tick_count % 30 == 0)
+  if (!quiet && tick_count - last_info_tick >= 30)
   {
+    last_info_tick = tick_count;
     printf("\x1b[1;1H");
-    printf("%-7u (%6.3fs): %2u tracks, %2u notes; %u bpm | %d%% | %s\x1b[K\n",
+    printf("%-7u (%6.3fs): %2u tracks, %2u notes; %u bpm | %d%% | %llu allocs | %s\x1b[K\n",
           tick_count, samples_processed / samplerate, tracks.size(),
-          audioSys.getNumActiveNotes(), tempo, (int)(tick_time * 100), ext_info.c_str());
+          audioSys.getNumActiveNotes(), tempo, (int)(tick_time * 100),
+          (unsigned long long)render_allocs, ext_info);
     for (SeqTrack &t : tracks)
     {
 
@@ -112,7 +265,6 @@ bool SeqController::tick(stk::WvOut &out)
         BankInstrument *instr = bank->instruments[t.getProg()].get();
         if (instr != nullptr && !instr->isPercussion)
         {
-          Note dummyNote;
           t.getInstr()->createNote(60, 64, &dummyNote);
           // printf(" [atk=%.3f dec=%.3f sus=%.3f rel=%.3f]", dummyNote.dbg_atk, dummyNote.dbg_dec, dummyNote.dbg_sus, dummyNote.dbg_rel);
         }
@@ -122,115 +274,601 @@ bool SeqController::tick(stk::WvOut &out)
   }
 
 #endif
-  samples_processed += outData.frames();
-  tick_count++;
+  // what the output does with the block is up to it
+  countAllocs(allocs_start);
+  out.tick(outData);
+  endBlock(samples);
   return true;
 }
 
+bool SeqController::beginBlock()
+{
+  if (timeline != nullptr) timeline->events.push_back(samples_processed);
+  if (!updateTracks()) return false;
+  // nothing changes until the next event, so render the whole gap at once.
+  // the fractional part of the tick length carries over between events, so
+  // every tick boundary lands on the sample it would at any tempo history.
+  next_event_tick = getNextEventTick();
+  uint64_t tick_length = getTickLength();
+  next_event_dist = (uint64_t)(next_event_tick - tick_count) * tick_length;
+  block_samples_left = (uint32_t)((next_event_dist + (TICK_FX_ONE - 1 - tick_frac)) >> TICK_FX_BITS);
+  event_start = samples_processed;
+  if (tick_length > 0)
+  {
+    event_tick_offset = (double)tick_frac / tick_length;
+    ticks_per_sample = (double)TICK_FX_ONE / tick_length;
+  }
+  if (timeline != nullptr)
+  {
+    for (SeqTrack &t : tracks) t.recordPerf(*timeline);
+  }
+
+  if (loop_jumped)
+  {
+    loop_jumped = false;
+    if (cache_loops && loop_limit <= 0 && !silent)
+    {
+      uint64_t allocs = getAllocCount();
+      checkLoop();
+      loop_search_allocs += getAllocCount() - allocs;
+    }
+  }
+  return true;
+}
+
+template <typename T>
+static void putState(std::vector<uint8_t> &state, const T &v)
+{
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(&v);
+  state.insert(state.end(), p, p + sizeof(T));
+}
+
+void SeqController::saveState(std::vector<uint8_t> &state)
+{
+  state.clear();
+  putState(state, tempo);
+  putState(state, timebase);
+  putState(state, next_event_tick - tick_count);
+  putState(state, (uint32_t)newTracks.size());
+  putState(state, (uint32_t)oldTracks.size());
+
+  // tracks are known by their place in the pool's order, which is the
+  // order they're mixed in. slots and addresses differ from one time round
+  // to the next
+  uint32_t rank[MAX_TRACKS];
+  uint32_t n = 0;
+  for (SeqTrack &t : tracks)
+  {
+    rank[tracks.handleOf(&t).index] = n++;
+    t.saveState(state, tick_count);
+  }
+
+  // the order tracks will run in
+  std::priority_queue<ScheduledTrack, std::vector<ScheduledTrack>,
+                      std::greater<ScheduledTrack>> queue = schedule;
+  while (!queue.empty())
+  {
+    const ScheduledTrack &entry = queue.top();
+    putState(state, entry.tick - tick_count);
+    putState(state, tracks.get(entry.track) != nullptr ? rank[entry.track.index] : UINT32_MAX);
+    queue.pop();
+  }
+}
+
+bool SeqController::notesStartedSince(uint32_t tick)
+{
+  for (SeqTrack &t : tracks)
+  {
+    uint32_t first = t.getFirstNoteStart();
+    if (first != UINT32_MAX && first < tick) return false;
+  }
+  return true;
+}
+
+void SeqController::checkLoop()
+{
+  // from a repeated state the tracks do the same again, so the audio
+  // repeats too once every note playing was started after the first time.
+  // voice stealing depends on more than that, so there mustn't be any
+  saveState(loop_state);
+  uint64_t stolen = audioSys.getNumStolen();
+
+  if (loop_mode == LOOP_RECORDING)
+  {
+    if (tick_count < loop_start.tick + loop_ticks) return;
+    if (tick_count == loop_start.tick + loop_ticks && loop_state == loop_start.state &&
+        stolen == loop_start.stolen && notesStartedSince(loop_start.tick))
+    {
+      loop_mode = LOOP_PLAYING;
+      loop_length = samples_processed - loop_start.pos;
+      loop_played = 0;
+      if (!quiet) printf("Loop of %.3fs cached\n", loop_length / samplerate);
+      return;
+    }
+    loop_mode = LOOP_SEARCHING;
+    loop_audio.clear();
+  }
+
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ULL;
+  for (uint8_t b : loop_state)
+  {
+    hash = (hash ^ b) * 1099511628211ULL;
+  }
+
+  LoopPoint here{loop_state, tick_count, samples_processed, stolen};
+  std::unordered_map<uint64_t, LoopPoint>::iterator it = loop_points.find(hash);
+  if (it == loop_points.end())
+  {
+    if (loop_points.size() < MAX_LOOP_POINTS) loop_points.emplace(hash, here);
+    return;
+  }
+
+  LoopPoint &point = it->second;
+  uint64_t length = samples_processed - point.pos;
+  if (point.state == loop_state && point.stolen == stolen && notesStartedSince(point.tick) &&
+      length <= loop_cache_seconds * samplerate)
+  {
+    loop_mode = LOOP_RECORDING;
+    loop_start = here;
+    loop_first_pos = point.pos;
+    loop_ticks = tick_count - point.tick;
+    loop_audio.clear();
+    loop_audio.reserve((length + 1) * 2);
+  }
+  // seen again later on, or a different state with the same hash
+  point = here;
+}
+
+void SeqController::countAllocs(uint64_t since)
+{
+  uint64_t allocs = getAllocCount() - since - loop_search_allocs;
+  loop_search_allocs = 0;
+  if (blocks_rendered < ALLOC_WARMUP_BLOCKS)
+  {
+    blocks_rendered++;
+    return;
+  }
+  render_allocs += allocs;
+#ifdef SYNTH_COUNT_ALLOCS
+  // counting builds check that buffers and containers have stopped growing
+  // by the end of the warm-up
+  if (allocs > 0)
+  {
+    printf("ERROR: %llu heap allocations rendering the block at %.3fs\n",
+           (unsigned long long)allocs, samples_processed / samplerate);
+  }
+  assert(allocs == 0);
+#endif
+}
+
+void SeqController::playLoop()
+{
+  uint32_t samples = (uint32_t)std::min<uint64_t>(max_block, loop_length - loop_played);
+  outBuf.resize(samples, 2);
+  const float *src = &loop_audio[loop_played * 2];
+  for (uint32_t i = 0; i < samples; i++)
+  {
+    outBuf(i, 0) = src[i * 2];
+    outBuf(i, 1) = src[i * 2 + 1];
+  }
+  samples_processed += samples;
+  loop_played = (loop_played + samples) % loop_length;
+}
+
+void SeqController::endBlock(uint32_t samples)
+{
+  samples_processed += samples;
+  block_samples_left -= samples;
+  if (block_samples_left == 0)
+  {
+    tick_count = next_event_tick;
+    tick_frac = tick_frac + ((samples_processed - event_start) << TICK_FX_BITS) - next_event_dist;
+  }
+}
+
+bool SeqController::skipTo(uint64_t until)
+{
+  // the tracks run exactly as they would while rendering; blocks just don't
+  // need splitting at max_block
+  silent = true;
+  bool running = true;
+  while (samples_processed < until)
+  {
+    if (block_samples_left == 0 && !beginBlock())
+    {
+      running = false;
+      break;
+    }
+    endBlock((uint32_t)std::min<uint64_t>(block_samples_left, until - samples_processed));
+  }
+  silent = false;
+  return running;
+}
+
+void SeqController::plan(SeqTimeline &t)
+{
+  t.notes.clear();
+  t.events.clear();
+  if (loop_limit <= 0)
+  {
+    // the sequence would never end
+    printf("ERROR: Can't plan a sequence without a loop limit\n");
+    t.length = 0;
+    return;
+  }
+  timeline = &t;
+  skipTo(UINT64_MAX);
+  timeline = nullptr;
+  t.length = samples_processed;
+}
+
 SeqTrack::SeqTrack(SeqController *controller, SeqParser *parser, uint32_t pc,
                     uint8_t id, float samplerate)
   : controller(controller), parser(parser), pc(pc), trackid(id)
 {
   instrument.setSampleRate(samplerate);
+  TrackStorage store;
+  controller->takeTrackStorage(store);
+  swapStorage(store);
+  output->resize(controller->max_block, 1, 0);
+  pitch_curve.resize(controller->max_block / Note::ENV_CHUNK + 1);
+}
+
+SeqTrack::~SeqTrack()
+{
+  // notes still held are cut off along with the track
+  SeqTimeline *timeline = controller->getTimeline();
+  if (timeline != nullptr)
+  {
+    uint64_t now = controller->getSamplesProcessed();
+    for (uint32_t i : timeline_spans)
+    {
+      SeqTimeline::Span &span = timeline->notes[i];
+      span.end = std::min(span.end, now);
+      if (span.cut_event == UINT32_MAX) span.cut_event = timeline->events.size() - 1;
+    }
+  }
+  for (NoteRef &ref : notes)
+  {
+    controller->audioSys.freeNote(ref.get());
+  }
+
+  slides.clear();
+  callstack.clear();
+  for (int i = 0; i < 7; i++)
+  {
+    voices[i].clear();
+  }
+  notes.clear();
+  live.clear();
+  TrackStorage store;
+  swapStorage(store);
+  controller->giveTrackStorage(store);
+}
+
+void SeqTrack::swapStorage(TrackStorage &store)
+{
+  std::swap(slides, store.slides);
+  std::swap(callstack, store.callstack);
   for (int i = 0; i < 7; i++)
   {
-    voices[i] = std::vector<Note *>();
+    std::swap(voices[i], store.voices[i]);
   }
+  std::swap(notes, store.notes);
+  std::swap(live, store.live);
+  std::swap(output, store.output);
+  std::swap(pitch_curve, store.pitch_curve);
 }
 
+// 2^(i / EXP2_STEPS) over one octave, read with linear interpolation. good
+// to about 1e-6, or a few thousandths of a cent
+static const uint32_t EXP2_STEPS = 256;
+
+static std::vector<double> buildExp2Table()
+{
+  std::vector<double> table(EXP2_STEPS + 2);
+  for (uint32_t i = 0; i < table.size(); i++)
+  {
+    table[i] = std::exp2((double)i / EXP2_STEPS);
+  }
+  return table;
+}
+
+// built at startup; the vibrato reads it while tracks render
+static const std::vector<double> exp2_table = buildExp2Table();
+
 static float semitones_to_pitch(float pitch)
 {
-  return std::pow(2.0, pitch / 12);
+  const std::vector<double> &table = exp2_table;
+  double x = pitch / 12.0;
+  double octave = std::floor(x);
+  double f = (x - octave) * EXP2_STEPS;
+  uint32_t i = (uint32_t)f;
+  double v = table[i] + (table[i + 1] - table[i]) * (f - i);
+  return (float)std::ldexp(v, (int)octave);
+}
+
+uint32_t SeqTrack::getTimelineID(SeqTimeline &timeline)
+{
+  if (timeline_id == UINT32_MAX)
+  {
+    timeline_id = timeline.tracks.size();
+    timeline.tracks.emplace_back();
+  }
+  return timeline_id;
+}
+
+void SeqTrack::recordPerf(SeqTimeline &timeline)
+{
+  std::vector<SeqTimeline::Perf> &perf = timeline.tracks[getTimelineID(timeline)];
+  // the vibrato's position is different at every event
+  bool vib = vibrato.isActive();
+  if (!perf.empty() && perf.back().volume == volume && perf.back().pan == pan &&
+      perf.back().pitch_ratio == pitch_ratio && !vib && !perf.back().vibrato.isActive()) return;
+  uint32_t event = timeline.events.size() - 1;
+  perf.push_back(SeqTimeline::Perf{event, volume, pan, pitch_ratio, pitch, vibrato,
+                                   vib ? getVibratoTicks() : 0, controller->getTicksPerSample()});
+}
+
+stk::StkFloat SeqTrack::getCullGain(double cull_db, float volume)
+{
+  // the track volume is applied after mixing, so take it off the threshold
+  stk::StkFloat cull_gain = std::pow(10.0, cull_db / 20);
+  if (cull_gain > 0) cull_gain = (volume != 0) ? cull_gain / std::fabs(volume) : HUGE_VAL;
+  return cull_gain;
 }
 
 void SeqTrack::setPerf(uint32_t type, float v)
 {
   // if (type == 0) printf("[track %u] set perf %d = %.3f\n", trackid, type, v);
   if (type == 0)      volume = v;
-  else if (type == 1) pitch = v;
+  else if (type == 1)
+  {
+    pitch = v;
+    pitch_ratio = semitones_to_pitch(pitch * 6);
+  }
   else if (type == 2) reverb = v;
   else                pan = v;
 }
 
-bool SeqTrack::tick(stk::StkFrames &data)
+double SeqTrack::getVibratoTicks()
+{
+  return (controller->getTickCount() - vibrato_tick) + controller->getEventTickOffset();
+}
+
+void SeqTrack::fillPitchCurve(float *curve, uint32_t samples, float pitch, const Lfo &vibrato,
+                              double ticks, double ticks_per_sample)
 {
-  while (delay_timer == 0)
+  for (uint32_t i = 0; i * Note::ENV_CHUNK < samples; i++)
   {
-    Step s = step();
-    if (s == STEP_FINISHED)
-    {
-      controller->removeTrack(this);
-      return true;
-    }
-    else if (s == STEP_ERROR)
-    {
-      return false;
-    }
-    else if (s == STEP_WAITING)
+    float vib = vibrato.getValue(ticks + i * Note::ENV_CHUNK * ticks_per_sample);
+    curve[i] = semitones_to_pitch((pitch + vib) * 6);
+  }
+}
+
+bool SeqTrack::update(uint32_t now)
+{
+  // bring the vibrato up to now before any commands change it
+  vibrato.advance(now - vibrato_tick);
+  vibrato_tick = now;
+
+  if (now >= wake_tick)
+  {
+    delay_timer = 0;
+    while (delay_timer == 0)
     {
-      break;
+      Step s = step();
+      if (s == STEP_FINISHED)
+      {
+        controller->removeTrack(this);
+        return true;
+      }
+      else if (s == STEP_ERROR)
+      {
+        return false;
+      }
+      else if (s == STEP_WAITING)
+      {
+        break;
+      }
     }
+    wake_tick = now + delay_timer;
   }
 
-  auto it = slides.begin();
-  while (it != slides.end())
+  // finished slides are compacted out in place so the vector keeps its storage
+  uint32_t kept = 0;
+  for (uint32_t i = 0; i < slides.size(); i++)
   {
-    Slide &s = *it;
+    Slide &s = slides[i];
     if (s.t >= s.duration)
     {
       setPerf(s.type, s.end);
-      slides.erase(it++);
     }
     else
     {
       setPerf(s.type, (s.end - s.start) * ((float)s.t / s.duration) + s.start);
       s.t++;
-      it++;
+      slides[kept++] = s;
     }
   }
+  slides.resize(kept);
+  return true;
+}
+
+bool SeqTrack::render(uint32_t samples, VoiceMixer *mixer)
+{
+  if (notes.empty())
+  {
+    // nothing to smooth over; the next notes start at the values of the time
+    ramp_valid = false;
+    return false;
+  }
+  // volume and pan ramp from where the last block left them
+  float volume_from = ramp_valid ? ramp_volume : volume;
+  pan_from = ramp_valid ? ramp_pan : pan;
+  ramp_volume = volume;
+  ramp_pan = pan;
+  ramp_valid = true;
 
-  uint32_t samples = controller->getSamplesPerTick();
-  if (data.size() < samples)
+  // only grows; a large enough buffer is reused as-is
+  if (output->frames() < samples)
   {
-    data.resize(samples);
+    output->resize(samples);
   }
-  for (uint32_t i = 0; i < samples; i++)
+  stk::StkFloat *buf = &(*output)[0];
+  std::fill(buf, buf + samples, 0.0);
+
+  // the vibrato is followed a chunk at a time; other pitch changes only
+  // happen between blocks
+  const float *curve = nullptr;
+  if (vibrato.isActive())
   {
-    stk::StkFloat total = 0;
-    auto iter = notes.begin();
-    while (iter != notes.end())
+    double tps = controller->getTicksPerSample();
+    double ticks = getVibratoTicks() + (controller->getSamplesProcessed() - controller->getEventStart()) * tps;
+    fillPitchCurve(pitch_curve.data(), samples, pitch, vibrato, ticks, tps);
+    curve = pitch_curve.data();
+  }
+
+  stk::StkFloat cull_gain = getCullGain(controller->cull_db, volume);
+  // held notes can outlast a fade, so theirs leaves the volume out
+  stk::StkFloat hold_cull_gain = getCullGain(controller->cull_db, 1);
+  // notes the voice pool stole for another track are dropped here
+  live.clear();
+  for (NoteRef &ref : notes)
+  {
+    Note *note = ref.get();
+    if (note == nullptr) continue;
+    note->pitch_adj = pitch_ratio;
+    note->pitch_curve = curve;
+    note->cull_gain = cull_gain;
+    note->hold_cull_gain = hold_cull_gain;
+    live.push_back(note);
+  }
+
+  Interpolator::Mode mode = controller->interp_mode;
+  if (mixer != nullptr)
+  {
+    mixer->mix(live.data(), live.size(), buf, samples, mode);
+  }
+  else
+  {
+    for (Note *note : live)
     {
-      Note* &note = *iter;
-      // note->env.setTickrate(samples);
-      note->pitch_adj = semitones_to_pitch(pitch * 6);
-      stk::StkFloat v = note->tick();
-      if (note->isFinished())
-      {
-        notes.erase(iter++);
-      }
-      else
-      {
-        total += v;
-        iter++;
-      }
+      if (note->isFinished()) continue;
+      note->render(buf, samples, mode);
     }
-    data[i] = total * volume;
   }
-  delay_timer--;
+
+  stk::StkFloat dv = (volume - volume_from) / samples;
+  for (uint32_t i = 0; i < samples; i++)
+  {
+    buf[i] *= volume_from + dv * (i + 1);
+  }
   return true;
 }
 
+uint32_t SeqTrack::getFirstNoteStart()
+{
+  uint32_t first = UINT32_MAX;
+  for (NoteRef &ref : notes)
+  {
+    Note *note = ref.get();
+    if (note != nullptr) first = std::min(first, note->started);
+  }
+  return first;
+}
+
+void SeqTrack::saveState(std::vector<uint8_t> &state, uint32_t now)
+{
+  putState(state, trackid);
+  putState(state, pc);
+  putState(state, finished);
+  putState(state, delay_timer);
+  putState(state, wake_tick - now);
+  // the loop count only matters if there's a limit
+  if (controller->loop_limit > 0) putState(state, loops);
+
+  putState(state, (uint32_t)callstack.size());
+  for (std::vector<uint32_t>::reverse_iterator it = callstack.rbegin(); it != callstack.rend(); ++it)
+  {
+    putState(state, *it);
+  }
+  putState(state, (uint32_t)slides.size());
+  for (const Slide &slide : slides)
+  {
+    putState(state, slide.type);
+    putState(state, slide.start);
+    putState(state, slide.end);
+    putState(state, slide.duration);
+    putState(state, slide.t);
+  }
+
+  putState(state, volume);
+  putState(state, pitch);
+  putState(state, reverb);
+  putState(state, pan);
+  // the vibrato as of now, not as of whenever the track last ran
+  Lfo vib = vibrato;
+  vib.advance(now - vibrato_tick);
+  putState(state, vib);
+  putState(state, pitch_ratio);
+  putState(state, ramp_volume);
+  putState(state, ramp_pan);
+  putState(state, pan_from);
+  putState(state, ramp_valid);
+  putState(state, bank_id);
+  putState(state, prog_id);
+  // which notes a voice-off would stop, by age. notes that have gone back to
+  // the pool don't count
+  for (std::vector<NoteRef> &voice : voices)
+  {
+    for (NoteRef &ref : voice)
+    {
+      Note *note = ref.get();
+      if (note != nullptr) putState(state, now - note->started);
+    }
+    putState(state, UINT32_MAX);
+  }
+}
+
+void SeqTrack::releaseNotes()
+{
+  // voices only need the notes a voice-off could still stop, so held
+  // notes that ended or were stolen don't pile up
+  for (int i = 0; i < 7; i++)
+  {
+    uint32_t held = 0;
+    for (NoteRef &ref : voices[i])
+    {
+      Note *note = ref.get();
+      if (note != nullptr && !note->isFinished()) voices[i][held++] = ref;
+    }
+    voices[i].erase(voices[i].begin() + held, voices[i].end());
+  }
+
+  uint32_t kept = 0;
+  for (NoteRef &ref : notes)
+  {
+    Note *note = ref.get();
+    if (note == nullptr) continue;
+    if (note->isFinished()) controller->audioSys.freeNote(note);
+    else notes[kept++] = ref;
+  }
+  notes.erase(notes.begin() + kept, notes.end());
+}
+
 SeqTrack::Step SeqTrack::step()
 {
   if (delay_timer > 0) return Step::STEP_WAITING;
 
-  std::unique_ptr<SeqCommand> cmd = parser->readCommand(pc);
+  SeqCommand *cmd = parser->readCommand(pc, cmd_slot);
   // printf("[track %u <%p>] %06x | %s\n", trackid, this, pc, cmd->getDisasm().c_str());
-  if (dynamic_cast<BadCmd *>(cmd.get()) != nullptr) return Step::STEP_ERROR;
+  if (dynamic_cast<BadCmd *>(cmd) != nullptr) return Step::STEP_ERROR;
   pc += cmd->getSize();
 
   {
-    CmdOpenTrack *cmd_ = dynamic_cast<CmdOpenTrack *>(cmd.get());
+    CmdOpenTrack *cmd_ = dynamic_cast<CmdOpenTrack *>(cmd);
     if (cmd_ != nullptr)
     {
       controller->addTrack(cmd_->getTrackID(), cmd_->getOffset());
@@ -239,7 +877,17 @@ SeqTrack::Step SeqTrack::step()
   }
 
   {
-    CmdTempo *cmd_ = dynamic_cast<CmdTempo *>(cmd.get());
+    CmdVibrato *cmd_ = dynamic_cast<CmdVibrato *>(cmd);
+    if (cmd_ != nullptr)
+    {
+      if (cmd_->isDepth()) vibrato.setDepth(cmd_->getValue() / 127.0f);
+      else                 vibrato.setRate(cmd_->getValue());
+      return Step::STEP_OK;
+    }
+  }
+
+  {
+    CmdTempo *cmd_ = dynamic_cast<CmdTempo *>(cmd);
     if (cmd_ != nullptr)
     {
       controller->tempo = cmd_->getTempo();
@@ -248,7 +896,7 @@ SeqTrack::Step SeqTrack::step()
   }
 
   {
-    CmdTimebase *cmd_ = dynamic_cast<CmdTimebase *>(cmd.get());
+    CmdTimebase *cmd_ = dynamic_cast<CmdTimebase *>(cmd);
     if (cmd_ != nullptr)
     {
       controller->timebase = cmd_->getTimebase();
@@ -257,7 +905,7 @@ SeqTrack::Step SeqTrack::step()
   }
 
   {
-    CmdSetParam *cmd_ = dynamic_cast<CmdSetParam *>(cmd.get());
+    CmdSetParam *cmd_ = dynamic_cast<CmdSetParam *>(cmd);
     if (cmd_ != nullptr)
     {
       if (cmd_->getType() == 0x20) // BANK
@@ -283,7 +931,7 @@ SeqTrack::Step SeqTrack::step()
   }
 
   {
-    CmdSetPerf *cmd_ = dynamic_cast<CmdSetPerf *>(cmd.get());
+    CmdSetPerf *cmd_ = dynamic_cast<CmdSetPerf *>(cmd);
     if (cmd_ != nullptr)
     {
       float val;
@@ -292,12 +940,19 @@ SeqTrack::Step SeqTrack::step()
       
       if (cmd_->getDuration() > 0)
       {
+        // every type past reverb sets the pan
+        uint8_t type = std::min<uint8_t>(cmd_->getType(), Slide::NUM_TYPES - 1);
         float start = 0;
-        if (cmd_->getType() == 0) start = volume;
-        else if (cmd_->getType() == 1) start = pitch;
-        else if (cmd_->getType() == 2) start = reverb;
-        else if (cmd_->getType() == 3) start = pan;
-        slides.push_back(Slide{cmd_->getType(), start, val, cmd_->getDuration(), 0});
+        if (type == 0) start = volume;
+        else if (type == 1) start = pitch;
+        else if (type == 2) start = reverb;
+        else start = pan;
+        // a new slide takes over from one already running on the same value
+        Slide slide{type, start, val, cmd_->getDuration(), 0};
+        std::vector<Slide>::iterator it = std::find_if(slides.begin(), slides.end(),
+            [type](const Slide &s) { return s.type == type; });
+        if (it != slides.end()) *it = slide;
+        else slides.push_back(slide);
       }
       else
       {
@@ -308,7 +963,7 @@ SeqTrack::Step SeqTrack::step()
   }
 
   {
-    CmdTrackEnd *cmd_ = dynamic_cast<CmdTrackEnd *>(cmd.get());
+    CmdTrackEnd *cmd_ = dynamic_cast<CmdTrackEnd *>(cmd);
     if (cmd_ != nullptr)
     {
       return Step::STEP_FINISHED;
@@ -316,19 +971,19 @@ SeqTrack::Step SeqTrack::step()
   }
 
   {
-    CmdJump *cmd_ = dynamic_cast<CmdJump *>(cmd.get());
+    CmdJump *cmd_ = dynamic_cast<CmdJump *>(cmd);
     if (cmd_ != nullptr)
     {
       if (cmd_->isCall())
       {
-        callstack.push(pc);
+        callstack.push_back(pc);
         pc = cmd_->getTarget();
       }
       else
       {
-        // TODO loop detection?
         pc = cmd_->getTarget();
         loops++;
+        controller->onLoopJump();
         if (controller->loop_limit > 0 && 
             loops >= controller->loop_limit) return Step::STEP_FINISHED;
       }
@@ -337,7 +992,7 @@ SeqTrack::Step SeqTrack::step()
   }
 
   {
-    CmdReturn *cmd_ = dynamic_cast<CmdReturn *>(cmd.get());
+    CmdReturn *cmd_ = dynamic_cast<CmdReturn *>(cmd);
     if (cmd_ != nullptr)
     {
       if (callstack.empty())
@@ -345,14 +1000,14 @@ SeqTrack::Step SeqTrack::step()
         printf("Seq ERROR: Stack underflow\n");
         return Step::STEP_ERROR;
       }
-      pc = callstack.top();
-      callstack.pop();
+      pc = callstack.back();
+      callstack.pop_back();
       return Step::STEP_OK;
     }
   }
 
   {
-    CmdReturnF *cmd_ = dynamic_cast<CmdReturnF *>(cmd.get());
+    CmdReturnF *cmd_ = dynamic_cast<CmdReturnF *>(cmd);
     if (cmd_ != nullptr)
     {
       if (callstack.empty())
@@ -360,27 +1015,27 @@ SeqTrack::Step SeqTrack::step()
         printf("Seq ERROR: Stack underflow\n");
         return Step::STEP_ERROR;
       }
-      pc = callstack.top();
-      callstack.pop();
+      pc = callstack.back();
+      callstack.pop_back();
       return Step::STEP_OK;
     }
   }
 
   {
-    CmdJumpF *cmd_ = dynamic_cast<CmdJumpF *>(cmd.get());
+    CmdJumpF *cmd_ = dynamic_cast<CmdJumpF *>(cmd);
     if (cmd_ != nullptr)
     {
       // TODO check condition
       if (cmd_->isCall())
       {
-        callstack.push(pc);
+        callstack.push_back(pc);
         pc = cmd_->getTarget();
       }
       else
       {
-        // TODO loop detection?
         pc = cmd_->getTarget();
         loops++;
+        controller->onLoopJump();
         if (controller->loop_limit > 0 && 
             loops >= controller->loop_limit) controller->removeTrack(this);
       }
@@ -389,7 +1044,7 @@ SeqTrack::Step SeqTrack::step()
   }
 
   {
-    CmdNoteOn *cmd_ = dynamic_cast<CmdNoteOn *>(cmd.get());
+    CmdNoteOn *cmd_ = dynamic_cast<CmdNoteOn *>(cmd);
     if (cmd_ != nullptr)
     {
       if (cmd_->getVoice() < 1 || cmd_->getVoice() > 7)
@@ -397,6 +1052,33 @@ SeqTrack::Step SeqTrack::step()
         return Step::STEP_ERROR;
       }
 
+      if (controller->isSilent())
+      {
+        // nothing plays; a planning pass notes down when it would, and for
+        // how long at most
+        SeqTimeline *timeline = controller->getTimeline();
+        if (timeline == nullptr) return Step::STEP_OK;
+        if (!instrument.createNote(cmd_->getNote(), cmd_->getVelocity(), &probe)) return Step::STEP_OK;
+        uint64_t start = controller->getSamplesProcessed();
+        uint32_t attack = probe.env.getLength(false);
+        uint64_t end = (attack == UINT32_MAX) ? UINT64_MAX : start + attack;
+        SeqTimeline::Span span;
+        span.start = start;
+        span.end = end;
+        span.release = probe.env.getLength(true);
+        span.instr = instrument;
+        span.key = cmd_->getNote();
+        span.vel = cmd_->getVelocity();
+        span.track = getTimelineID(*timeline);
+        span.on_event = timeline->events.size() - 1;
+        span.off_event = UINT32_MAX;
+        span.cut_event = UINT32_MAX;
+        voice_spans[cmd_->getVoice() - 1].push_back(timeline->notes.size());
+        timeline_spans.push_back(timeline->notes.size());
+        timeline->notes.push_back(span);
+        return Step::STEP_OK;
+      }
+
       Note *note = controller->audioSys.getNewNote();
       if (note == nullptr)
       {
@@ -405,23 +1087,40 @@ SeqTrack::Step SeqTrack::step()
       bool success = instrument.createNote(cmd_->getNote(), cmd_->getVelocity(), note);
       if (!success)
       {
-        note->stopNow(); // reset state
+        controller->audioSys.freeNote(note);
         return Step::STEP_OK;
       }
       note->start();
+      note->started = controller->getTickCount();
       
       voices[cmd_->getVoice() - 1].push_back(note);
       notes.push_back(note);
+      // grow outside of rendering
+      if (live.capacity() < notes.size()) live.reserve(notes.capacity());
       return Step::STEP_OK;
     }
   }
 
   {
-    CmdVoiceOff *cmd_ = dynamic_cast<CmdVoiceOff *>(cmd.get());
+    CmdVoiceOff *cmd_ = dynamic_cast<CmdVoiceOff *>(cmd);
     if (cmd_ != nullptr)
     {
-      for (Note* &note : voices[cmd_->getVoice() - 1])
+      SeqTimeline *timeline = controller->getTimeline();
+      if (timeline != nullptr)
+      {
+        uint64_t now = controller->getSamplesProcessed();
+        for (uint32_t i : voice_spans[cmd_->getVoice() - 1])
+        {
+          SeqTimeline::Span &span = timeline->notes[i];
+          span.off_event = timeline->events.size() - 1;
+          if (span.release == UINT32_MAX) continue;
+          span.end = std::min(span.end, now + span.release);
+        }
+        voice_spans[cmd_->getVoice() - 1].clear();
+      }
+      for (NoteRef &ref : voices[cmd_->getVoice() - 1])
       {
+        Note *note = ref.get();
         if (note != nullptr) note->stop();
       }
       voices[cmd_->getVoice() - 1].clear();
@@ -430,7 +1129,7 @@ SeqTrack::Step SeqTrack::step()
   }
 
   {
-    CmdWait *cmd_ = dynamic_cast<CmdWait *>(cmd.get());
+    CmdWait *cmd_ = dynamic_cast<CmdWait *>(cmd);
     if (cmd_ != nullptr)
     {
       delay_timer = cmd_->getDelay();
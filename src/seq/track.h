@@ -4,19 +4,76 @@
 #include "parser.h"
 #include "../instrument.h"
 #include "../audio_system.h"
+#include "../slot_pool.h"
+#include "../voice_mixer.h"
+#include "../lfo.h"
+#include "../worker_pool.h"
 #include <stk/WvOut.h>
 #include <stk/Stk.h>
-#include <stack>
+#include <memory>
+#include <queue>
 #include <set>
-#include <list>
 #include <vector>
 #include <string>
 #include <chrono>
+#include <unordered_map>
 
 class SeqController;
 
+// what a run of the sequence does, worked out without rendering it (see
+// SeqController::plan())
+struct SeqTimeline
+{
+  struct Span
+  {
+    // sample the note starts on, and the latest one it can still be playing
+    // on (UINT64_MAX if that isn't known)
+    uint64_t start;
+    uint64_t end;
+    // length of the note's release; UINT32_MAX if it never ends
+    uint32_t release;
+
+    // enough to play the note by itself: how it was started, by which
+    // track, and the events (indices into `events`) on which it starts, is
+    // released and is cut off with its track. UINT32_MAX if it never is
+    SampleInstr instr;
+    uint8_t key;
+    uint8_t vel;
+    uint32_t track;
+    uint32_t on_event;
+    uint32_t off_event;
+    uint32_t cut_event;
+  };
+
+  // a track's performance values from an event on
+  struct Perf
+  {
+    uint32_t event;
+    float volume;
+    float pan;
+    float pitch_ratio;
+    // while the vibrato runs: the pitch it goes around, the LFO, how many
+    // ticks after its phase the event's first sample is, and the length of
+    // a sample in ticks
+    float pitch;
+    Lfo vibrato;
+    double vibrato_ticks;
+    double ticks_per_sample;
+  };
+
+  std::vector<Span> notes;
+  // samples on which the tracks run. blocks only start on these, or every
+  // max_block samples after one
+  std::vector<uint64_t> events;
+  // per track, in the order they first ran; only changes are listed
+  std::vector<std::vector<Perf>> tracks;
+  uint64_t length = 0;
+};
+
 struct Slide
 {
+  // volume, pitch, reverb or pan; a track has at most one of each
+  static const uint8_t NUM_TYPES = 4;
   uint8_t type;
   float start;
   float end;
@@ -24,15 +81,32 @@ struct Slide
   uint32_t t;
 };
 
+// a track's containers. closed tracks hand them on to new ones, so opening
+// a track doesn't allocate once as many have been open at once before
+struct TrackStorage
+{
+  std::vector<Slide> slides;
+  std::vector<uint32_t> callstack;
+  std::vector<NoteRef> voices[7];
+  std::vector<NoteRef> notes;
+  std::vector<Note *> live;
+  std::unique_ptr<stk::StkFrames> output;
+  std::vector<float> pitch_curve;
+};
+
 class SeqTrack
 {
 private:
   SeqParser *parser;
   SeqController *controller;
+  SeqParser::CmdSlot cmd_slot;
   uint32_t pc = 0;
-  std::stack<uint32_t> callstack;
-  std::list<Slide> slides;
+  std::vector<uint32_t> callstack;
+  std::vector<Slide> slides;
   uint32_t delay_timer = 0;
+  // tick at which the VM runs again
+  uint32_t wake_tick = 0;
+  bool finished = false;
 
   uint8_t trackid = 0;
   uint32_t loops = 0;
@@ -41,15 +115,43 @@ private:
   float pitch  = 0;
   float reverb = 0;
   float pan    = 0.5;
+  // the vibrato's phase is as of vibrato_tick. it's read per chunk while
+  // rendering, into pitch_curve, instead of moving the pitch every tick
+  Lfo vibrato;
+  uint32_t vibrato_tick = 0;
+  // 2^(pitch / 2), worked out when the pitch changes
+  float pitch_ratio = 1;
+  // volume and pan at the end of the last block, and pan at the start of it.
+  // not valid if the last block had no notes
+  float ramp_volume = 0;
+  float ramp_pan = 0.5;
+  float pan_from = 0.5;
+  bool ramp_valid = false;
 
   SampleInstr instrument;
-  std::vector<Note *> voices[7];
-  std::list<Note *> notes;
+  std::vector<NoteRef> voices[7];
+  std::vector<NoteRef> notes;
+  // the notes in `notes` still ours at the start of a block
+  std::vector<Note *> live;
+  // this track's mix for the current block, before panning
+  std::unique_ptr<stk::StkFrames> output;
+  // pitch ratio for each chunk of the current block, while the vibrato runs
+  std::vector<float> pitch_curve;
+  // while planning: this track's index in the timeline, the spans of all
+  // its notes, and of the ones held on each voice
+  uint32_t timeline_id = UINT32_MAX;
+  std::vector<uint32_t> timeline_spans;
+  std::vector<uint32_t> voice_spans[7];
+  Note probe;
+  uint32_t getTimelineID(SeqTimeline &timeline);
 
   uint16_t bank_id = 0;
   uint16_t prog_id = 0;
 
+  void swapStorage(TrackStorage &store);
   void setPerf(uint32_t type, float v);
+  // ticks from the vibrato's phase to the first sample of the current event
+  double getVibratoTicks();
 public:
   enum Step
   {
@@ -61,39 +163,172 @@ public:
 
   SeqTrack(SeqController *controller, SeqParser *parser,
             uint32_t pc, uint8_t id, float samplerate);
+  // gives any notes still playing back to the voice pool
+  ~SeqTrack();
 
   Step step();
-  bool tick(stk::StkFrames &data);
+  // run the VM if its wait has expired and advance slides; false on error
+  bool update(uint32_t now);
+  // mixes the notes into getOutput() through mixer, or one at a time with
+  // Note::render if null. false if the track had no notes, in which case the
+  // output is left as it was. tracks can render in parallel, each with its
+  // own mixer; the voice pool is only touched by releaseNotes()
+  bool render(uint32_t samples, VoiceMixer *mixer);
+  // give finished notes back to the voice pool; call after render()
+  void releaseNotes();
+  // note down the performance values as of the current event, if they changed
+  void recordPerf(SeqTimeline &timeline);
+  // notes are culled below this gain, given the track volume (see cull_db)
+  static stk::StkFloat getCullGain(double cull_db, float volume);
+  // pitch ratio at the start of each Note::ENV_CHUNK of a block `samples`
+  // long, whose first sample is `ticks` after the vibrato's phase
+  static void fillPitchCurve(float *curve, uint32_t samples, float pitch, const Lfo &vibrato,
+                             double ticks, double ticks_per_sample);
+  const stk::StkFrames &getOutput() { return *output; }
+  uint32_t getNumNotes() { return notes.size(); }
+  // tick the oldest note still playing started on; UINT32_MAX if none are
+  uint32_t getFirstNoteStart();
+  // append everything that decides what the track does from now on, apart
+  // from the notes playing; equal states play out the same way
+  void saveState(std::vector<uint8_t> &state, uint32_t now);
+
+  // next tick at which update() has anything to do
+  uint32_t getNextTick(uint32_t now) { return slides.empty() ? wake_tick : now + 1; }
+  bool isFinished() { return finished; }
+  void setFinished() { finished = true; }
 
   uint32_t getPC() { return pc; }
   float getVolume() { return volume; }
   float getPitch() { return pitch; }
   float getReverb() { return reverb; }
   float getPan() { return pan; }
+  // pan at the start of the last block rendered
+  float getPanFrom() { return pan_from; }
   uint16_t getBank() { return bank_id; }
   uint16_t getProg() { return prog_id; }
   uint32_t getTrackID() { return trackid; }
 
   SampleInstr *getInstr() { return &instrument; }
+};
 
-  bool operator==(const SeqTrack &other) const
+typedef SlotPool<SeqTrack>::Handle TrackHandle;
+
+struct ScheduledTrack
+{
+  uint32_t tick;
+  uint32_t order; // tracks due on the same tick run in the order they were opened
+  TrackHandle track;
+
+  bool operator>(const ScheduledTrack &other) const
   {
-    return memcmp(this, &other, sizeof(SeqTrack)) == 0;
+    return tick > other.tick || (tick == other.tick && order > other.order);
   }
 };
 
 class SeqController
 {
 private:
-  std::list<SeqTrack> tracks;
-  std::vector<SeqTrack> newTracks;
-  std::vector<SeqTrack *> oldTracks; 
+  // containers of closed tracks, for the next ones opened. declared ahead
+  // of the tracks so it outlives them
+  std::vector<TrackStorage> spare_storage;
+  // tracks live in a fixed pool and never move or get copied
+  SlotPool<SeqTrack> tracks{MAX_TRACKS};
+  // opened/finished during this tick; scheduled/freed at the start of the next
+  std::vector<TrackHandle> newTracks;
+  std::vector<TrackHandle> oldTracks;
+  // tracks keyed by the next tick they need to be updated on
+  std::priority_queue<ScheduledTrack, std::vector<ScheduledTrack>,
+                      std::greater<ScheduledTrack>> schedule;
+  uint32_t next_order = 0;
   uint32_t tick_count = 0;
-  uint32_t samples_processed = 0;
+  uint32_t next_event_tick = 0;
+  // exact positions in 32.32 fixed-point samples: how far the current
+  // event's first sample falls after tick_count (under one sample), and how
+  // far next_event_tick falls after tick_count. kept relative, so they don't
+  // overflow however long the song plays
+  uint64_t tick_frac = 0;
+  uint64_t next_event_dist = 0;
+  // samples left to render before next_event_tick is reached
+  uint32_t block_samples_left = 0;
+  uint32_t last_info_tick = 0;
+  uint64_t samples_processed = 0;
   float samplerate;
+  // where the current event starts: its first sample, how many ticks after
+  // tick_count that falls, and the length of a sample in ticks until the
+  // next event
+  uint64_t event_start = 0;
+  double event_tick_offset = 0;
+  double ticks_per_sample = 0;
 
+  // render buffers, reused from block to block
   stk::StkFrames tickBufL;
   stk::StkFrames tickBufR;
+  stk::StkFrames outBuf;
+  // one mixer per render thread
+  std::vector<std::unique_ptr<VoiceMixer>> mixers;
+  std::unique_ptr<WorkerPool> workers;
+  // tracks to render this block, heaviest first
+  std::vector<SeqTrack *> render_jobs;
+  uint32_t render_samples = 0;
+  static void renderJob(void *ctx, uint32_t index, uint32_t worker);
+  // heap allocations made by tick() once warmed up (see alloc_count.h). the
+  // loop cache's search is left out; it stops once a loop is found
+  static const uint32_t ALLOC_WARMUP_BLOCKS = 256;
+  uint32_t blocks_rendered = 0;
+  uint64_t render_allocs = 0;
+  uint64_t loop_search_allocs = 0;
+  void countAllocs(uint64_t since);
+  // set while the sequence runs without audio; notes aren't started, and
+  // are noted down in the timeline instead if there is one
+  bool silent = false;
+  SeqTimeline *timeline = nullptr;
+
+  // run the tracks due now and find the length of the block up to the next event
+  bool beginBlock();
+  void endBlock(uint32_t samples);
+
+  // loop caching (see cache_loops). the state at a loop jump, the tick and
+  // sample it was on and the voices stolen by then
+  struct LoopPoint
+  {
+    std::vector<uint8_t> state;
+    uint32_t tick;
+    uint64_t pos;
+    uint64_t stolen;
+  };
+  enum LoopMode
+  {
+    LOOP_SEARCHING,
+    LOOP_RECORDING,
+    LOOP_PLAYING
+  };
+  static const uint32_t MAX_LOOP_POINTS = 1024;
+  // keyed by a hash of the state
+  std::unordered_map<uint64_t, LoopPoint> loop_points;
+  std::vector<uint8_t> loop_state;
+  bool loop_jumped = false;
+  LoopMode loop_mode = LOOP_SEARCHING;
+  // the iteration being recorded or played: where it started, and the state
+  // and voice pool steals then. its length in ticks, and in samples once
+  // it's recorded
+  LoopPoint loop_start;
+  // where that state was first seen, one time round earlier
+  uint64_t loop_first_pos = 0;
+  uint32_t loop_ticks = 0;
+  uint64_t loop_length = 0;
+  uint64_t loop_played = 0;
+  // interleaved stereo
+  std::vector<float> loop_audio;
+
+  void saveState(std::vector<uint8_t> &state);
+  // every note playing started on tick or later
+  bool notesStartedSince(uint32_t tick);
+  void checkLoop();
+  // fills outBuf from the recording
+  void playLoop();
+
+  // for the status display; notes allocate their buffers when made
+  Note dummyNote;
 
   float tick_time_tmp = 0;
   float tick_time = 0;
@@ -103,29 +338,95 @@ public:
   AudioSystem &audioSys;
   SeqParser &parser;
 
-  std::string ext_info = "";
+  // appended to the status line; a fixed buffer so updating it doesn't
+  // allocate on the render thread
+  char ext_info[64] = "";
 
   uint16_t tempo = 0;
   uint16_t timebase = 0;
   int loop_limit = 2;
   double volume = 1.0;
+  // upper limit on the samples produced by one call to tick()
+  uint32_t max_block = 8192;
+  // render notes with the scalar Note::render() instead of the SIMD mixer
+  bool reference_voices = false;
+  // resampling kernel for every note (see interp.h for the cost of each)
+  Interpolator::Mode interp_mode = Interpolator::LINEAR;
+  // released notes quieter than this (envelope * velocity * volumes) for a
+  // whole block are stopped early, as are held ones quieter than it before
+  // the track volume. -INFINITY keeps them to the end
+  double cull_db = -96.0;
+  // leave out the status display and track messages
+  bool quiet = false;
+  // with loop_limit <= 0, watch for the sequence coming back round to a
+  // state it was in before. the next time round is recorded and then
+  // played back over and over instead of being rendered. ticks don't fall
+  // on whole samples, so the recording can be a fraction of a sample off
+  // the true length of the loop. loops longer than loop_cache_seconds
+  // aren't cached
+  bool cache_loops = false;
+  double loop_cache_seconds = 300;
+
+  static const uint32_t MAX_TRACKS = 256;
+
+  // render tracks on this many threads (1 by default, 0 for one per core).
+  // output is the same for any number of threads
+  void setRenderThreads(uint32_t threads);
+  uint32_t getRenderThreads() { return mixers.size(); }
 
   SeqController(AudioSystem& system, SeqParser& parser, float samplerate);
   
   void addTrack(uint8_t id, uint32_t off);
   void removeTrack(SeqTrack *t);
+  // for SeqTrack: containers of a closed track, or new ones
+  void takeTrackStorage(TrackStorage &store);
+  void giveTrackStorage(TrackStorage &store);
+
+  static const uint32_t TICK_FX_BITS = 32;
+  static const uint64_t TICK_FX_ONE = 1ULL << TICK_FX_BITS;
 
-  uint32_t getSamplesPerTick();
+  double getSamplesPerTick();
+  // tick length in 32.32 fixed-point samples
+  uint64_t getTickLength();
+  // first tick on which any track has something to do
+  uint32_t getNextEventTick();
   float getSamplerate() { return samplerate; }
+  uint64_t getEventStart() { return event_start; }
+  double getEventTickOffset() { return event_tick_offset; }
+  double getTicksPerSample() { return ticks_per_sample; }
 
   // Stats
   uint32_t getTickCount() { return tick_count; }
-  uint32_t getSamplesProcessed() { return samples_processed; }
+  uint64_t getSamplesProcessed() { return samples_processed; }
   uint32_t getTrackCount() { return tracks.size(); }
   uint32_t getActiveNotes() { return audioSys.getNumActiveNotes(); }
+  uint64_t getRenderAllocs() { return render_allocs; }
 
+  // run every track that is due on the current tick (no audio)
+  bool updateTracks();
+  // render up to max_block samples, stopping early at the next sequence event
   bool tick(stk::WvOut &out);
 
+  // run the whole sequence without audio, recording where its events and
+  // notes fall. the controller is used up afterwards. needs loop_limit > 0
+  void plan(SeqTimeline &timeline);
+  // run without audio up to sample `until`, which has to be an event in the
+  // timeline. notes that would have started before it are left out. false
+  // if the sequence ends first
+  bool skipTo(uint64_t until);
+  bool isSilent() { return silent; }
+  // called by tracks taking a loop's jump back
+  void onLoopJump() { loop_jumped = true; }
+  bool isPlayingCachedLoop() { return loop_mode == LOOP_PLAYING; }
+  // sample the cached iteration started on, and its length in samples;
+  // only meaningful once isPlayingCachedLoop()
+  uint64_t getLoopStart() { return loop_start.pos; }
+  uint64_t getLoopLength() { return loop_length; }
+  // sample the repeated state was first seen on, one time round before
+  // getLoopStart()
+  uint64_t getLoopFirstSeen() { return loop_first_pos; }
+  SeqTimeline *getTimeline() { return timeline; }
+
 };
 
 #endif // SYNTH_SEQ_TRACK_H
@@ -0,0 +1,174 @@
+#ifndef SYNTH_SLOT_POOL_H
+#define SYNTH_SLOT_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <new>
+#include <memory>
+#include <utility>
+
+/*
+  Fixed-capacity pool of T. Objects are constructed in place and never move,
+  so pointers stay valid until the object is removed. Add and remove are O(1).
+  Live objects are kept on a linked list in the order they were added, which
+  is the order they are iterated in.
+
+  Handles carry a generation count, so a handle to a removed object is
+  detected instead of silently referring to whatever reused its slot.
+*/
+template <typename T>
+class SlotPool
+{
+public:
+  struct Handle
+  {
+    uint32_t index = NONE;
+    uint32_t generation = 0;
+
+    bool isValid() const { return index != NONE; }
+    bool operator==(const Handle &other) const
+    {
+      return index == other.index && generation == other.generation;
+    }
+  };
+
+  static const uint32_t NONE = 0xFFFFFFFF;
+
+private:
+  struct Slot
+  {
+    alignas(T) unsigned char storage[sizeof(T)];
+    uint32_t generation = 0;
+    uint32_t prev = NONE;
+    uint32_t next = NONE; // next live slot, or next free slot
+    bool used = false;
+
+    T *get() { return reinterpret_cast<T *>(storage); }
+  };
+
+  std::unique_ptr<Slot[]> slots;
+  uint32_t capacity;
+  uint32_t count = 0;
+  uint32_t free_head = NONE;
+  uint32_t head = NONE;
+  uint32_t tail = NONE;
+
+public:
+  class iterator
+  {
+  private:
+    SlotPool *pool;
+    uint32_t idx;
+  public:
+    iterator(SlotPool *pool, uint32_t idx) : pool(pool), idx(idx) {}
+    T &operator*() { return *pool->slots[idx].get(); }
+    T *operator->() { return pool->slots[idx].get(); }
+    iterator &operator++() { idx = pool->slots[idx].next; return *this; }
+    bool operator!=(const iterator &other) const { return idx != other.idx; }
+  };
+
+  SlotPool(uint32_t capacity) : slots(new Slot[capacity]), capacity(capacity)
+  {
+    for (uint32_t i = 0; i < capacity; i++)
+    {
+      slots[i].next = (i + 1 < capacity) ? i + 1 : NONE;
+    }
+    free_head = capacity > 0 ? 0 : NONE;
+  }
+
+  ~SlotPool()
+  {
+    clear();
+  }
+
+  SlotPool(const SlotPool &) = delete;
+  SlotPool &operator=(const SlotPool &) = delete;
+
+  // returns an invalid handle if the pool is full
+  template <typename... Args>
+  Handle add(Args &&...args)
+  {
+    Handle h;
+    if (free_head == NONE) return h;
+
+    uint32_t i = free_head;
+    Slot &s = slots[i];
+    free_head = s.next;
+
+    new (s.storage) T(std::forward<Args>(args)...);
+    s.used = true;
+    s.prev = tail;
+    s.next = NONE;
+    if (tail != NONE) slots[tail].next = i;
+    else head = i;
+    tail = i;
+    count++;
+
+    h.index = i;
+    h.generation = s.generation;
+    return h;
+  }
+
+  void remove(Handle h)
+  {
+    if (get(h) == nullptr) return;
+    uint32_t i = h.index;
+    Slot &s = slots[i];
+
+    s.get()->~T();
+    s.used = false;
+    s.generation++;
+
+    if (s.prev != NONE) slots[s.prev].next = s.next;
+    else head = s.next;
+    if (s.next != NONE) slots[s.next].prev = s.prev;
+    else tail = s.prev;
+
+    s.prev = NONE;
+    s.next = free_head;
+    free_head = i;
+    count--;
+  }
+
+  void clear()
+  {
+    while (head != NONE)
+    {
+      remove(Handle{head, slots[head].generation});
+    }
+  }
+
+  // nullptr if the handle is stale
+  T *get(Handle h)
+  {
+    if (h.index >= capacity) return nullptr;
+    Slot &s = slots[h.index];
+    if (!s.used || s.generation != h.generation) return nullptr;
+    return s.get();
+  }
+
+  // handle for an object that lives in this pool
+  Handle handleOf(const T *p)
+  {
+    Handle h;
+    if (capacity == 0) return h;
+    // storage is the first member, so slot i starts at base + i * sizeof(Slot)
+    const unsigned char *base = slots[0].storage;
+    ptrdiff_t off = reinterpret_cast<const unsigned char *>(p) - base;
+    if (off < 0 || (size_t)off >= sizeof(Slot) * capacity || off % sizeof(Slot) != 0) return h;
+    uint32_t i = off / sizeof(Slot);
+    if (!slots[i].used) return h;
+    h.index = i;
+    h.generation = slots[i].generation;
+    return h;
+  }
+
+  uint32_t size() { return count; }
+  uint32_t getCapacity() { return capacity; }
+  bool full() { return free_head == NONE; }
+
+  iterator begin() { return iterator(this, head); }
+  iterator end() { return iterator(this, NONE); }
+};
+
+#endif // SYNTH_SLOT_POOL_H
@@ -0,0 +1,291 @@
+#include "voice_mixer.h"
+
+#include <algorithm>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+  4-wide double vector. Only the handful of operations the resampling loop
+  needs are provided, once per instruction set.
+*/
+#if defined(__AVX__)
+
+typedef __m256d vd;
+
+static inline vd vload(const double *p) { return _mm256_load_pd(p); }
+static inline vd vloadu(const double *p) { return _mm256_loadu_pd(p); }
+static inline vd vadd(vd a, vd b) { return _mm256_add_pd(a, b); }
+static inline vd vsub(vd a, vd b) { return _mm256_sub_pd(a, b); }
+static inline vd vmul(vd a, vd b) { return _mm256_mul_pd(a, b); }
+static inline double vsum(vd a)
+{
+  __m128d s = _mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+static const char *SIMD_NAME = "AVX";
+
+#elif defined(__SSE2__)
+
+struct vd { __m128d lo, hi; };
+
+static inline vd vload(const double *p) { return vd{_mm_load_pd(p), _mm_load_pd(p + 2)}; }
+static inline vd vloadu(const double *p) { return vd{_mm_loadu_pd(p), _mm_loadu_pd(p + 2)}; }
+static inline vd vadd(vd a, vd b) { return vd{_mm_add_pd(a.lo, b.lo), _mm_add_pd(a.hi, b.hi)}; }
+static inline vd vsub(vd a, vd b) { return vd{_mm_sub_pd(a.lo, b.lo), _mm_sub_pd(a.hi, b.hi)}; }
+static inline vd vmul(vd a, vd b) { return vd{_mm_mul_pd(a.lo, b.lo), _mm_mul_pd(a.hi, b.hi)}; }
+static inline double vsum(vd a)
+{
+  __m128d s = _mm_add_pd(a.lo, a.hi);
+  return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+static const char *SIMD_NAME = "SSE2";
+
+#else
+
+struct vd { double v[4]; };
+
+#define VD_OP(name, expr) \
+  static inline vd name(vd a, vd b) { vd r; for (int i = 0; i < 4; i++) r.v[i] = (expr); return r; }
+
+static inline vd vload(const double *p) { vd r; for (int i = 0; i < 4; i++) r.v[i] = p[i]; return r; }
+static inline vd vloadu(const double *p) { return vload(p); }
+VD_OP(vadd, a.v[i] + b.v[i])
+VD_OP(vsub, a.v[i] - b.v[i])
+VD_OP(vmul, a.v[i] * b.v[i])
+static inline double vsum(vd a) { return (a.v[0] + a.v[2]) + (a.v[1] + a.v[3]); }
+
+#undef VD_OP
+
+static const char *SIMD_NAME = "scalar";
+
+#endif
+
+static_assert(VoiceMixer::LANES == 4, "vector helpers are 4 lanes wide");
+
+static const double PHASE_SCALE = 1.0 / Wave::PHASE_ONE;
+
+// read by lanes that have no note, with room for the widest kernel
+static const stk::StkFloat SILENCE[2 * Wave::GUARD_SAMPLES + 1] = {0};
+
+// sum of coef[k] * src[k] over one kernel
+template <uint32_t TAPS>
+static inline double dot(const double *coef, const stk::StkFloat *src)
+{
+  vd acc = vmul(vloadu(coef), vloadu(src));
+  for (uint32_t k = 4; k < TAPS; k += 4)
+  {
+    acc = vadd(acc, vmul(vloadu(coef + k), vloadu(src + k)));
+  }
+  return vsum(acc);
+}
+
+VoiceMixer::VoiceMixer(uint32_t max_notes)
+{
+  active.reserve(max_notes);
+  for (uint32_t l = 0; l < LANES; l++) clearLane(l);
+}
+
+const char *VoiceMixer::getSimdName()
+{
+  return SIMD_NAME;
+}
+
+void VoiceMixer::clearLane(uint32_t lane)
+{
+  base[lane] = SILENCE + Wave::GUARD_SAMPLES;
+  phase[lane] = 0;
+  phase_inc[lane] = 0;
+  level[lane] = 0;
+  lane_wave[lane] = nullptr;
+  for (uint32_t i = 0; i < CHUNK; i++) gain[i * LANES + lane] = 0;
+  lane_note[lane] = nullptr;
+  lane_ended[lane] = false;
+  lane_count[lane] = 0;
+}
+
+void VoiceMixer::loadLane(uint32_t lane, Note *note, uint32_t n)
+{
+  stk::StkFloat g[CHUNK];
+  bool ended;
+  uint32_t count = note->prepareChunk(g, n, ended);
+  for (uint32_t i = 0; i < n; i++)
+  {
+    gain[i * LANES + lane] = (i < count) ? g[i] : 0;
+  }
+
+  Wave *wave = note->wave;
+  base[lane] = wave->samples(note->level);
+  phase[lane] = note->phase;
+  phase_inc[lane] = note->phase_inc;
+  level[lane] = note->level;
+  lane_wave[lane] = wave;
+  lane_note[lane] = note;
+  lane_ended[lane] = ended;
+  lane_count[lane] = count;
+}
+
+template <bool LOOPED>
+void VoiceMixer::renderGroup(stk::StkFloat *out, uint32_t n)
+{
+  uint32_t done = 0;
+  while (done < n)
+  {
+    // run every lane up to the first loop end, or the first note end
+    uint32_t span = n - done;
+    for (uint32_t l = 0; l < LANES; l++)
+    {
+      if (lane_wave[l] == nullptr) continue;
+      if (done >= lane_count[l])
+      {
+        // the note ended partway through the chunk; its gain is zero from
+        // here on, so stop it reading past the end of the wave
+        base[l] = SILENCE + Wave::GUARD_SAMPLES;
+        phase[l] = 0;
+        phase_inc[l] = 0;
+        level[l] = 0;
+        lane_wave[l] = nullptr;
+        continue;
+      }
+      uint32_t left = lane_count[l] - done;
+      if (LOOPED) left = lane_wave[l]->wrapSpan(phase[l], phase_inc[l], left);
+      if (left < span) span = left;
+    }
+    (this->*render_span)(out + done, &gain[done * LANES], span);
+    done += span;
+  }
+}
+
+// no lane passes its loop end within a span, and the guard samples cover
+// every read the kernels make around the position
+
+void VoiceMixer::renderNearest(stk::StkFloat *out, const double *gain, uint32_t n)
+{
+  alignas(32) double val[LANES];
+
+  for (uint32_t i = 0; i < n; i++)
+  {
+    for (uint32_t l = 0; l < LANES; l++)
+    {
+      uint64_t p = phase[l] >> level[l];
+      val[l] = base[l][(uint32_t)((p + (Wave::PHASE_ONE >> 1)) >> Wave::PHASE_BITS)];
+      phase[l] += phase_inc[l];
+    }
+    out[i] += vsum(vmul(vload(val), vload(&gain[i * LANES])));
+  }
+}
+
+void VoiceMixer::renderLinear(stk::StkFloat *out, const double *gain, uint32_t n)
+{
+  alignas(32) double s0[LANES];
+  alignas(32) double s1[LANES];
+  alignas(32) double off[LANES];
+
+  for (uint32_t i = 0; i < n; i++)
+  {
+    for (uint32_t l = 0; l < LANES; l++)
+    {
+      uint64_t p = phase[l] >> level[l];
+      uint32_t idx = (uint32_t)(p >> Wave::PHASE_BITS);
+      off[l] = (uint32_t)p * PHASE_SCALE;
+      s0[l] = base[l][idx];
+      s1[l] = base[l][idx + 1];
+      phase[l] += phase_inc[l];
+    }
+
+    vd a = vload(s0);
+    vd b = vload(s1);
+    vd v = vmul(vadd(vmul(vsub(b, a), vload(off)), a), vload(&gain[i * LANES]));
+    out[i] += vsum(v);
+  }
+}
+
+template <uint32_t TAPS>
+void VoiceMixer::renderPoly(stk::StkFloat *out, const double *gain, uint32_t n)
+{
+  alignas(32) double val[LANES];
+
+  for (uint32_t i = 0; i < n; i++)
+  {
+    // each lane's kernel is a short dot product; vectorize along the taps
+    for (uint32_t l = 0; l < LANES; l++)
+    {
+      uint64_t p = phase[l] >> level[l];
+      uint32_t idx = (uint32_t)(p >> Wave::PHASE_BITS);
+      const double *row = table + Interpolator::getRow((uint32_t)p) * TAPS;
+      val[l] = dot<TAPS>(row, base[l] + idx - (TAPS / 2 - 1));
+      phase[l] += phase_inc[l];
+    }
+    out[i] += vsum(vmul(vload(val), vload(&gain[i * LANES])));
+  }
+}
+
+void VoiceMixer::mix(Note *const *notes, uint32_t count, stk::StkFloat *out, uint32_t frames,
+                     Interpolator::Mode mode)
+{
+  table = Interpolator::getTable(mode);
+  switch (mode)
+  {
+    case Interpolator::NEAREST: render_span = &VoiceMixer::renderNearest; break;
+    case Interpolator::CUBIC:   render_span = &VoiceMixer::renderPoly<4>; break;
+    case Interpolator::SINC8:   render_span = &VoiceMixer::renderPoly<8>; break;
+    case Interpolator::SINC16:  render_span = &VoiceMixer::renderPoly<16>; break;
+    default:                    render_span = &VoiceMixer::renderLinear; break;
+  }
+
+  // looped notes first, so only the group that straddles the two kinds
+  // mixes them and the rest skip the loop checks entirely
+  active.clear();
+  for (uint32_t i = 0; i < count; i++)
+  {
+    if (notes[i]->beginBlock()) active.push_back(notes[i]);
+  }
+  std::vector<Note *>::iterator split = std::partition(active.begin(), active.end(),
+                                                       [](Note *note) { return note->wave->loop; });
+  uint32_t looped = split - active.begin();
+
+  uint32_t done = 0;
+  while (done < frames && !active.empty())
+  {
+    uint32_t n = frames - done;
+    if (n > CHUNK) n = CHUNK;
+
+    for (uint32_t g = 0; g < active.size(); g += LANES)
+    {
+      for (uint32_t l = 0; l < LANES; l++)
+      {
+        if (g + l < active.size()) loadLane(l, active[g + l], n);
+        else clearLane(l);
+      }
+
+      if (g < looped) renderGroup<true>(out + done, n);
+      else renderGroup<false>(out + done, n);
+
+      for (uint32_t l = 0; l < LANES; l++)
+      {
+        Note *note = lane_note[l];
+        if (note == nullptr) continue;
+        if (lane_ended[l]) note->finish();
+        else note->phase = phase[l];
+      }
+    }
+
+    uint32_t kept = 0;
+    uint32_t kept_looped = 0;
+    for (uint32_t i = 0; i < active.size(); i++)
+    {
+      Note *note = active[i];
+      if (note->isFinished()) continue;
+      active[kept++] = note;
+      if (i < looped) kept_looped++;
+    }
+    active.resize(kept);
+    looped = kept_looped;
+    done += n;
+  }
+}
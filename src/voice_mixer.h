@@ -0,0 +1,76 @@
+#ifndef SYNTH_VOICE_MIXER_H
+#define SYNTH_VOICE_MIXER_H
+
+#include <stk/Stk.h>
+#include <stdint.h>
+#include <vector>
+
+#include "instrument.h"
+
+/*
+  Mixes a set of notes into one buffer. The notes are rendered LANES at a
+  time: their playback state is copied into structure-of-arrays form at the
+  start of each chunk and written back at its end, and the interpolation
+  runs across all lanes with SIMD. A lane group is 4 doubles, one AVX
+  register or two SSE2 ones (plain C++ when neither is targeted); there is
+  no 8-wide path. The cubic and sinc kernels
+  are vectorized along their taps instead, one lane at a time. Fixed-point
+  phases and the sample fetches they address are stepped per lane.
+
+  Loop wrapping is done between spans, at the first point where any lane
+  would reach its loop end. Envelopes are read per note from the
+  instrument's precomputed curves, by Note::prepareChunk().
+
+  Output matches adding up Note::render() for each note, apart from the
+  order in which the lanes and taps are summed.
+*/
+class VoiceMixer
+{
+public:
+  static const uint32_t LANES = 4;
+  static const uint32_t CHUNK = Note::ENV_CHUNK;
+
+private:
+  // SoA state for one lane group
+  uint64_t phase[LANES];
+  uint64_t phase_inc[LANES];
+  uint32_t level[LANES]; // reads are at phase >> level
+  alignas(32) double gain[CHUNK * LANES]; // interleaved: gain[i * LANES + lane]
+  const stk::StkFloat *base[LANES];
+  Wave *lane_wave[LANES];
+
+  Note *lane_note[LANES];
+  bool lane_ended[LANES];
+  uint32_t lane_count[LANES]; // audible samples in the current chunk
+
+  std::vector<Note *> active;
+  const double *table = nullptr;
+  // span renderer for the current interpolation mode, picked once per mix()
+  typedef void (VoiceMixer::*SpanFn)(stk::StkFloat *out, const double *gain, uint32_t n);
+  SpanFn render_span = nullptr;
+
+  void loadLane(uint32_t lane, Note *note, uint32_t n);
+  void clearLane(uint32_t lane);
+  // LOOPED is false when no lane in the group plays a looped wave
+  template <bool LOOPED>
+  void renderGroup(stk::StkFloat *out, uint32_t n);
+  void renderNearest(stk::StkFloat *out, const double *gain, uint32_t n);
+  void renderLinear(stk::StkFloat *out, const double *gain, uint32_t n);
+  // polyphase kernels from Interpolator tables
+  template <uint32_t TAPS>
+  void renderPoly(stk::StkFloat *out, const double *gain, uint32_t n);
+
+public:
+  // max_notes is the most notes one mix() call will be given (a track
+  // can't have more than the voice pool); more still work, but allocate
+  explicit VoiceMixer(uint32_t max_notes);
+
+  // add `frames` samples of every note into out
+  void mix(Note *const *notes, uint32_t count, stk::StkFloat *out, uint32_t frames,
+           Interpolator::Mode mode = Interpolator::LINEAR);
+
+  // name of the instruction set the mixer was compiled for
+  static const char *getSimdName();
+};
+
+#endif // SYNTH_VOICE_MIXER_H
@@ -0,0 +1,80 @@
+#include "worker_pool.h"
+
+#include "alloc_count.h"
+
+WorkerPool::WorkerPool(uint32_t threads)
+{
+  for (uint32_t i = 1; i < threads; i++)
+  {
+    this->threads.emplace_back(&WorkerPool::workerMain, this, i);
+  }
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    std::lock_guard<std::mutex> l(lock);
+    stopping = true;
+  }
+  start_cv.notify_all();
+  for (std::thread &t : threads) t.join();
+}
+
+void WorkerPool::runJobs(uint32_t worker)
+{
+  uint32_t i;
+  while ((i = next.fetch_add(1)) < count)
+  {
+    fn(ctx, i, worker);
+  }
+}
+
+void WorkerPool::workerMain(uint32_t worker)
+{
+  uint64_t seen = 0;
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> l(lock);
+      start_cv.wait(l, [&] { return stopping || generation != seen; });
+      if (stopping) return;
+      seen = generation;
+    }
+
+    uint64_t allocs = getAllocCount();
+    runJobs(worker);
+    job_allocs += getAllocCount() - allocs;
+
+    {
+      std::lock_guard<std::mutex> l(lock);
+      if (--busy == 0) done_cv.notify_one();
+    }
+  }
+}
+
+void WorkerPool::run(uint32_t count, JobFn fn, void *ctx)
+{
+  if (threads.empty())
+  {
+    for (uint32_t i = 0; i < count; i++) fn(ctx, i, 0);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> l(lock);
+    this->fn = fn;
+    this->ctx = ctx;
+    this->count = count;
+    next.store(0);
+    busy = threads.size();
+    generation++;
+  }
+  start_cv.notify_all();
+
+  runJobs(0);
+
+  std::unique_lock<std::mutex> l(lock);
+  done_cv.wait(l, [&] { return busy == 0; });
+  // the batch allocated on the caller's behalf
+  addAllocCount(job_allocs.exchange(0));
+}
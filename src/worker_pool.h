@@ -0,0 +1,59 @@
+#ifndef SYNTH_WORKER_POOL_H
+#define SYNTH_WORKER_POOL_H
+
+#include <stdint.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+/*
+  Persistent worker threads that run a batch of jobs at a time. Jobs are
+  claimed from a shared cursor, so whichever thread is free takes the next
+  one and long jobs don't hold up a fixed share of the batch. The calling
+  thread works on the batch too, as worker 0. Running a batch doesn't
+  allocate.
+*/
+class WorkerPool
+{
+public:
+  // called once for each index of a batch. worker is in [0, getThreads())
+  typedef void (*JobFn)(void *ctx, uint32_t index, uint32_t worker);
+
+private:
+  std::vector<std::thread> threads;
+  std::mutex lock;
+  std::condition_variable start_cv;
+  std::condition_variable done_cv;
+
+  // current batch; generation changes when a new one starts
+  uint64_t generation = 0;
+  bool stopping = false;
+  JobFn fn = nullptr;
+  void *ctx = nullptr;
+  uint32_t count = 0;
+  std::atomic<uint32_t> next{0};
+  // pool threads still working on the batch
+  uint32_t busy = 0;
+  // heap allocations the pool threads made during the batch
+  std::atomic<uint64_t> job_allocs{0};
+
+  void workerMain(uint32_t worker);
+  void runJobs(uint32_t worker);
+
+public:
+  // threads includes the caller; 1 runs everything on the calling thread
+  WorkerPool(uint32_t threads);
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  // runs fn for every index in [0, count) and waits for all of them
+  void run(uint32_t count, JobFn fn, void *ctx);
+
+  uint32_t getThreads() { return threads.size() + 1; }
+};
+
+#endif // SYNTH_WORKER_POOL_H
@@ -0,0 +1,363 @@
+/*
+  Plays envelopes through Envelope, which reads them from the precomputed
+  curves, and through a copy of the segment stepper it used before them,
+  and checks the two agree. The curves are stored as floats, so they can
+  only differ by float rounding.
+*/
+#include "../src/instrument.h"
+
+#include <stdio.h>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+// a level and a carry, each rounded to float
+static const double CURVE_TOLERANCE = 1e-7;
+// what stepping segments instead of working out each sample costs
+static const double BASELINE_TOLERANCE = 1e-4;
+static const uint32_t LENGTH = 44100;
+
+static double convertEnvValue(int16_t v)
+{
+  return v / 32767.0;
+}
+
+// Envelope as it was before the curves: each segment is stepped as it
+// plays, a chunk at a time. root segments are exact, like the curves',
+// rather than read from the table the stepper had
+class SteppedEnvelope
+{
+private:
+  double pos = 0;
+  double inc = 0;
+  uint32_t curr_env = 0;
+  const Osci *osci = nullptr;
+  bool release = false;
+  Envp last_env = {0, 0, 0};
+  double last_val = 0;
+  double hold_val = 0;
+
+  const std::vector<Envp> &points() { return release ? osci->relEnv : osci->atkEnv; }
+
+  void renderSegment(double *out, uint32_t n)
+  {
+    const Envp &next_data = points()[curr_env];
+    double dt = next_data.time - last_env.time;
+    double y = (last_env.mode == 0xff) ? hold_val : convertEnvValue(last_env.value);
+    double dy = convertEnvValue(next_data.value) - y;
+    double u = (dt > 0) ? (pos - last_env.time) / dt : 0;
+    double du = (dt > 0) ? inc / dt : 0;
+
+    if (next_data.mode == Envp::LINEAR)
+    {
+      double v = y + dy * u;
+      double dv = dy * du;
+      for (uint32_t i = 0; i < n; i++)
+      {
+        out[i] = v;
+        v += dv;
+      }
+    }
+    else if (next_data.mode == Envp::SQUARE)
+    {
+      double sq = u * u;
+      double d1 = 2 * u * du + du * du;
+      double d2 = 2 * du * du;
+      for (uint32_t i = 0; i < n; i++)
+      {
+        out[i] = y + dy * sq;
+        sq += d1;
+        d1 += d2;
+      }
+    }
+    else if (next_data.mode == Envp::ROOT)
+    {
+      for (uint32_t i = 0; i < n; i++)
+      {
+        out[i] = y + dy * ((u > 0) ? std::sqrt(u) : 0);
+        u += du;
+      }
+    }
+    else
+    {
+      double v = 0;
+      if (next_data.mode == Envp::DIRECT) v = y + dy;
+      else if (next_data.mode == Envp::HOLD) v = y;
+      for (uint32_t i = 0; i < n; i++) out[i] = v;
+    }
+    pos += inc * n;
+    last_val = out[n - 1];
+  }
+
+  void loopBack(uint32_t target)
+  {
+    hold_val = last_val;
+    uint16_t start = (target > 0) ? points()[target - 1].time : 0;
+    last_env = {0xff, start, 0};
+    pos = start;
+    curr_env = target;
+  }
+
+public:
+  SteppedEnvelope(const Osci *osci, double rate) : inc(1000.0 / rate), osci(osci) {}
+
+  Envelope::Status getStatus()
+  {
+    const Envp &env = points()[curr_env];
+    if (env.mode == Envp::STOP) return Envelope::FINISHED;
+    if (env.mode == Envp::HOLD) return Envelope::HOLD;
+    if (env.mode == Envp::LOOP && (uint16_t)env.value >= curr_env) return Envelope::HOLD;
+    return Envelope::ACTIVE;
+  }
+
+  uint32_t render(double *out, uint32_t n)
+  {
+    uint32_t i = 0;
+    bool advanced = false;
+    while (i < n)
+    {
+      Envelope::Status status = getStatus();
+      if (status == Envelope::FINISHED) return i;
+      if (status == Envelope::HOLD)
+      {
+        double v = convertEnvValue(last_env.value);
+        for (; i < n; i++) out[i] = v;
+        last_val = v;
+        return n;
+      }
+
+      const Envp &next_data = points()[curr_env];
+      if (next_data.mode == Envp::LOOP)
+      {
+        loopBack(next_data.value);
+        continue;
+      }
+      if (!advanced && pos >= next_data.time)
+      {
+        last_env = next_data;
+        curr_env++;
+        advanced = true;
+        continue;
+      }
+
+      uint32_t count = n - i;
+      if (pos < next_data.time)
+      {
+        double left = std::ceil((next_data.time - pos) / inc);
+        if (left < count) count = (uint32_t)left;
+      }
+      else if (advanced)
+      {
+        count = 1;
+      }
+      renderSegment(out + i, count);
+      i += count;
+      advanced = false;
+    }
+    return n;
+  }
+
+  double tick()
+  {
+    double v = 0;
+    render(&v, 1);
+    return v;
+  }
+
+  void beginRelease()
+  {
+    release = true;
+    pos = 0;
+    curr_env = 0;
+    last_env = {0xff, 0, 0};
+    hold_val = last_val;
+  }
+};
+
+// Envelope as it was before either: every sample works out where it is in
+// its segment from scratch. it knows nothing of loops
+class BaselineEnvelope
+{
+private:
+  double pos = 0;
+  double inc = 0;
+  uint32_t curr_env = 0;
+  const Osci *osci = nullptr;
+  bool release = false;
+  Envp last_env = {0, 0, 0};
+  double last_val = 0;
+  double hold_val = 0;
+
+  const std::vector<Envp> &points() { return release ? osci->relEnv : osci->atkEnv; }
+
+public:
+  BaselineEnvelope(const Osci *osci, double rate) : inc(1000.0 / rate), osci(osci) {}
+
+  Envelope::Status getStatus()
+  {
+    const Envp &env = points()[curr_env];
+    if (env.mode == Envp::STOP) return Envelope::FINISHED;
+    if (env.mode == Envp::HOLD) return Envelope::HOLD;
+    return Envelope::ACTIVE;
+  }
+
+  double tick()
+  {
+    Envelope::Status status = getStatus();
+    double next_value;
+    if (status == Envelope::HOLD)
+    {
+      next_value = convertEnvValue(last_env.value);
+    }
+    else if (status == Envelope::FINISHED)
+    {
+      next_value = 0;
+    }
+    else
+    {
+      Envp next_data = points()[curr_env];
+      if (pos >= next_data.time)
+      {
+        last_env = points()[curr_env];
+        curr_env++;
+        next_data = points()[curr_env];
+      }
+      double dt = next_data.time - last_env.time;
+      double t = pos - last_env.time;
+      double y = (last_env.mode == 0xff) ? hold_val : convertEnvValue(last_env.value);
+      double dy = convertEnvValue(next_data.value) - y;
+      pos += inc;
+
+      if (next_data.mode == Envp::LINEAR) next_value = y + dy * (t / dt);
+      else if (next_data.mode == Envp::SQUARE) next_value = y + dy * (t / dt) * (t / dt);
+      else if (next_data.mode == Envp::ROOT) next_value = y + dy * std::sqrt(t / dt);
+      else if (next_data.mode == Envp::DIRECT) next_value = y + dy;
+      else if (next_data.mode == Envp::HOLD) next_value = y;
+      else next_value = 0;
+    }
+    last_val = next_value;
+    return next_value;
+  }
+
+  void beginRelease()
+  {
+    release = true;
+    pos = 0;
+    curr_env = 0;
+    last_env = {0xff, 0, 0};
+    hold_val = last_val;
+  }
+};
+
+struct EnvCase
+{
+  const char *name;
+  std::vector<Envp> atk;
+  std::vector<Envp> rel;
+  // sample the release starts on
+  uint32_t release_at;
+};
+
+static std::vector<EnvCase> makeCases()
+{
+  std::vector<Envp> rel = {{Envp::ROOT, 150, 0}, {Envp::STOP, 0, 0}};
+  std::vector<Envp> rel_linear = {{Envp::LINEAR, 300, 0}, {Envp::STOP, 0, 0}};
+  return {
+    {"linear to hold", {{Envp::LINEAR, 20, 32767}, {Envp::LINEAR, 200, 20000}, {Envp::HOLD, 0, 0}}, rel, 20000},
+    {"root and square", {{Envp::ROOT, 10, 32767}, {Envp::SQUARE, 300, 12000}, {Envp::HOLD, 0, 0}}, rel_linear, 30000},
+    {"release mid-attack", {{Envp::LINEAR, 20, 32767}, {Envp::SQUARE, 400, 8000}, {Envp::HOLD, 0, 0}}, rel, 6000},
+    {"release mid-root", {{Envp::ROOT, 250, 32767}, {Envp::HOLD, 0, 0}}, rel_linear, 3000},
+    {"direct steps", {{Envp::DIRECT, 0, 30000}, {Envp::LINEAR, 50, 20000}, {Envp::DIRECT, 120, 5000},
+                      {Envp::SQUARE, 200, 25000}, {Envp::HOLD, 0, 0}}, rel, 15000},
+    {"to a stop", {{Envp::LINEAR, 30, 32767}, {Envp::ROOT, 180, 0}, {Envp::STOP, 0, 0}}, rel, LENGTH},
+    {"looped", {{Envp::LINEAR, 20, 32767}, {Envp::SQUARE, 90, 9000}, {Envp::LINEAR, 160, 28000},
+                {Envp::LOOP, 0, 1}}, rel, 25000},
+  };
+}
+
+// largest difference over LENGTH samples at `rate`
+static double compare(const EnvCase &c, double rate, bool &ok)
+{
+  Osci osci;
+  osci.atkEnv = c.atk;
+  osci.relEnv = c.rel;
+
+  // the attack and the release each in one go, the way the curves are built
+  // from it. stepped in smaller pieces, a point due exactly on a sample can
+  // round either side of it
+  SteppedEnvelope ref(&osci, rate);
+  std::vector<double> want(LENGTH, 0);
+  uint32_t atk_length = std::min(c.release_at, LENGTH);
+  uint32_t want_end = ref.render(want.data(), atk_length);
+  if (want_end == atk_length && c.release_at < LENGTH)
+  {
+    ref.beginRelease();
+    want_end = c.release_at + ref.render(&want[c.release_at], LENGTH - c.release_at);
+  }
+
+  Envelope env;
+  env.init(&osci);
+  env.setSamplerate(rate);
+  uint32_t end = LENGTH;
+  double worst = 0;
+  for (uint32_t i = 0; i < LENGTH; i++)
+  {
+    if (i == c.release_at) env.beginRelease();
+    stk::StkFloat v = 0;
+    if (env.render(&v, 1) == 0 && end == LENGTH) end = i;
+    worst = std::max(worst, std::fabs(v - want[i]));
+  }
+  if (end != want_end)
+  {
+    printf("%s @ %.0f: stopped at sample %u, not %u\n", c.name, rate, end, want_end);
+    ok = false;
+  }
+  return worst;
+}
+
+// largest difference from the baseline over LENGTH samples at `rate`
+static double compareBaseline(const EnvCase &c, double rate)
+{
+  Osci osci;
+  osci.atkEnv = c.atk;
+  osci.relEnv = c.rel;
+  BaselineEnvelope ref(&osci, rate);
+  Envelope env;
+  env.init(&osci);
+  env.setSamplerate(rate);
+
+  double worst = 0;
+  for (uint32_t i = 0; i < LENGTH; i++)
+  {
+    if (i == c.release_at)
+    {
+      ref.beginRelease();
+      env.beginRelease();
+    }
+    // the baseline gave zeros once stopped (and one more on reaching the
+    // stop), as does tick()
+    worst = std::max(worst, std::fabs(env.tick() - ref.tick()));
+  }
+  return worst;
+}
+
+int main()
+{
+  bool ok = true;
+  for (const EnvCase &c : makeCases())
+  {
+    for (double rate : {32000.0, 44100.0, 48000.0})
+    {
+      double worst = compare(c, rate, ok);
+      bool pass = worst <= CURVE_TOLERANCE;
+      ok = ok && pass;
+      printf("%s @ %.0f: %s, largest difference %g\n", c.name, rate, pass ? "ok" : "FAILED", worst);
+      if (c.atk.back().mode == Envp::LOOP) continue;
+      worst = compareBaseline(c, rate);
+      pass = worst <= BASELINE_TOLERANCE;
+      ok = ok && pass;
+      printf("%s @ %.0f vs baseline: %s, largest difference %g\n", c.name, rate, pass ? "ok" : "FAILED", worst);
+    }
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+/*
+  Starts a note on a track whose volume is still 0, lets its envelope reach
+  the hold, then slides the volume up to full. The note has to be heard at
+  the end: a held envelope doesn't fall, so however quiet the track is
+  while it holds, it mustn't be culled for it.
+*/
+#include "../src/audio_system.h"
+#include "../src/seq/parser.h"
+#include "../src/seq/track.h"
+#include "test_banks.h"
+
+#include <stk/WvOut.h>
+
+#include <stdio.h>
+#include <cmath>
+#include <sstream>
+#include <string>
+
+static const char *AAF_NAME = "hold_cull_test.aaf";
+static const char *AW_NAME = "hold_cull_test.aw";
+static const float SAMPLERATE = 44100;
+// seconds in, once the slide is over
+static const double CHECK_FROM = 1.2;
+static const stk::StkFloat MIN_PEAK = 0.01;
+
+static Bytes makeSequence()
+{
+  Bytes s;
+  s.u8(0xFE); s.u16(48);  // timebase
+  s.u8(0xFD); s.u16(120); // tempo; a beat is 0.5s
+  s.u8(0xA4); s.u8(0x20); s.u8(1);
+  s.u8(0xA4); s.u8(0x21); s.u8(0);
+  // the volume starts at 0
+  s.u8(60); s.u8(1); s.u8(100);
+  s.u8(0x80); s.u8(48);
+  s.u8(0x9A); s.u8(0); s.u8(127); s.u8(48);
+  s.u8(0x80); s.u8(96);
+  s.u8(0x81);
+  s.u8(0xFF);
+  s.zeros(4); // waits are read as if they could be 5 bytes long
+  return s;
+}
+
+// loudest sample from CHECK_FROM on
+class PeakOut : public stk::WvOut
+{
+public:
+  uint64_t frames = 0;
+  stk::StkFloat peak = 0;
+
+  void tick(const stk::StkFloat sample) override
+  {
+    if (frames++ >= CHECK_FROM * SAMPLERATE) peak = std::max(peak, std::fabs(sample));
+  }
+
+  void tick(const stk::StkFrames &f) override
+  {
+    for (uint32_t i = 0; i < f.frames(); i++) tick(f(i, 0));
+  }
+};
+
+int main()
+{
+  if (!writeTestBanks(AAF_NAME, AW_NAME))
+  {
+    printf("ERROR: Could not write the test banks\n");
+    return 1;
+  }
+
+  Bytes seq = makeSequence();
+  std::istringstream seq_in(std::string(seq.data.begin(), seq.data.end()));
+  SeqParser parser;
+  parser.load(seq_in);
+  AudioSystem system(AAF_NAME, ".");
+  SeqController controller(system, parser, SAMPLERATE);
+  controller.quiet = true;
+
+  PeakOut out;
+  while (controller.tick(out));
+  remove(AAF_NAME);
+  remove(AW_NAME);
+
+  bool ok = out.frames > CHECK_FROM * SAMPLERATE && out.peak > MIN_PEAK;
+  printf("held note after the volume slide: %s, peak %g\n", ok ? "ok" : "FAILED", out.peak);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+/*
+  Plays a small generated sequence through SeqController well past its
+  warm-up and checks tick() makes no heap allocations after it. Built with
+  SYNTH_COUNT_ALLOCS, so any allocation is counted (and asserted on) by the
+  controller itself.
+
+  The sequence plays all of test_banks.h's instruments on three tracks,
+  with notes, voice-offs, pitch and pan slides and vibrato, so most of the
+  per-note and per-track render paths get a turn.
+*/
+#include "../src/audio_system.h"
+#include "../src/seq/parser.h"
+#include "../src/seq/track.h"
+#include "test_banks.h"
+
+#include <stk/WvOut.h>
+
+#include <stdio.h>
+#include <sstream>
+#include <vector>
+#include <string>
+
+static const char *AAF_NAME = "render_allocs_test.aaf";
+static const char *AW_NAME = "render_allocs_test.aw";
+static const uint32_t NUM_BLOCKS = 2000;
+static const uint32_t MAX_BLOCK = 512;
+static const uint32_t THREADS = 2;
+
+static Bytes makeSequence()
+{
+  Bytes s;
+  s.u8(0xFE); s.u16(48);  // timebase
+  s.u8(0xFD); s.u16(137); // tempo
+  s.u8(0xA4); s.u8(0x20); s.u8(1);
+  s.u8(0xA4); s.u8(0x21); s.u8(0);
+  s.u8(0xC1); s.u8(1); uint32_t track1 = s.size(); s.ptr24(0);
+  s.u8(0xC1); s.u8(2); uint32_t track2 = s.size(); s.ptr24(0);
+  s.u8(0x94); s.u8(3); s.u8(64);
+  s.u8(0x94); s.u8(0); s.u8(110);
+
+  // melody with a pitch slide and a long note
+  uint32_t loop = s.size();
+  for (uint8_t n : {60, 64, 67, 72})
+  {
+    s.u8(n); s.u8(1); s.u8(100);
+    s.u8(0x80); s.u8(24);
+    s.u8(0x81);
+    s.u8(n + 12); s.u8(2); s.u8(80);
+    s.u8(0x80); s.u8(12);
+  }
+  s.u8(0x9A); s.u8(1); s.u8(30); s.u8(48);
+  s.u8(62); s.u8(3); s.u8(110);
+  s.u8(0x80); s.u8(96);
+  s.u8(0x83);
+  s.u8(0x9A); s.u8(1); s.u8(0); s.u8(24);
+  s.u8(0x80); s.u8(30);
+  s.u8(0xC7); s.ptr24(loop);
+
+  // percussion
+  s.put24(track1, s.size());
+  s.u8(0xA4); s.u8(0x20); s.u8(1);
+  s.u8(0xA4); s.u8(0x21); s.u8(1);
+  s.u8(0x94); s.u8(3); s.u8(20);
+  s.u8(0x94); s.u8(0); s.u8(100);
+  loop = s.size();
+  for (uint8_t k : {36, 42, 38, 42})
+  {
+    s.u8(k); s.u8(1); s.u8(120);
+    s.u8(0x80); s.u8(12);
+    s.u8(0x81);
+  }
+  s.u8(0xC7); s.ptr24(loop);
+
+  // pad with vibrato, a pan slide and voice-off releases
+  s.put24(track2, s.size());
+  s.u8(0xA4); s.u8(0x20); s.u8(1);
+  s.u8(0xA4); s.u8(0x21); s.u8(2);
+  s.u8(0x94); s.u8(0); s.u8(90);
+  s.u8(0xE6); s.u16(0x0600);
+  s.u8(0xF4); s.u8(8);
+  loop = s.size();
+  s.u8(48); s.u8(1); s.u8(90);
+  s.u8(55); s.u8(2); s.u8(70);
+  s.u8(0x9A); s.u8(3); s.u8(120); s.u8(96);
+  s.u8(0x88); s.u16(192);
+  s.u8(0x81);
+  s.u8(0x82);
+  s.u8(0x80); s.u8(40);
+  s.u8(0x9A); s.u8(3); s.u8(10); s.u8(48);
+  s.u8(0x80); s.u8(8);
+  s.u8(0xC7); s.ptr24(loop);
+  return s;
+}
+
+// throws the audio away; tick() doesn't count what the output does anyway
+class NullOut : public stk::WvOut
+{
+public:
+  void tick(const stk::StkFloat /* sample */) override {}
+  void tick(const stk::StkFrames & /* frames */) override {}
+};
+
+int main()
+{
+  if (!writeTestBanks(AAF_NAME, AW_NAME))
+  {
+    printf("ERROR: Could not write the test banks\n");
+    return 1;
+  }
+
+  Bytes seq = makeSequence();
+  std::istringstream seq_in(std::string(seq.data.begin(), seq.data.end()));
+  SeqParser parser;
+  parser.load(seq_in);
+  AudioSystem system(AAF_NAME, ".");
+  SeqController controller(system, parser, 44100);
+  controller.quiet = true;
+  controller.loop_limit = -1;
+  controller.max_block = MAX_BLOCK;
+  controller.setRenderThreads(THREADS);
+
+  NullOut out;
+  uint32_t blocks = 0;
+  while (blocks < NUM_BLOCKS && controller.tick(out))
+  {
+    blocks++;
+  }
+  remove(AAF_NAME);
+  remove(AW_NAME);
+
+  // the controller only starts counting after its warm-up (256 blocks)
+  if (blocks < NUM_BLOCKS)
+  {
+    printf("ERROR: The sequence stopped after %u blocks\n", blocks);
+    return 1;
+  }
+  if (controller.getRenderAllocs() > 0)
+  {
+    printf("FAILED: %llu heap allocations after warm-up\n",
+           (unsigned long long)controller.getRenderAllocs());
+    return 1;
+  }
+  printf("%u blocks, %.3fs: no heap allocations after warm-up\n", blocks,
+         controller.getSamplesProcessed() / 44100.0);
+  return 0;
+}
@@ -0,0 +1,241 @@
+#include "test_banks.h"
+
+#include "../src/aaf.h"
+#include "../src/banks.h"
+
+#include <cmath>
+#include <fstream>
+#include <algorithm>
+
+struct FixtureWave
+{
+  uint8_t key;
+  float rate;
+  uint32_t offset;
+  uint32_t count;
+  bool loop;
+  uint32_t loop_start;
+};
+
+static uint32_t addEnv(Bytes &b, const std::vector<Envp> &points)
+{
+  uint32_t off = b.align();
+  for (const Envp &p : points)
+  {
+    b.u16(p.mode);
+    b.u16(p.time);
+    b.u16(p.value);
+  }
+  return off;
+}
+
+static uint32_t addOsci(Bytes &b, uint32_t atk, uint32_t rel)
+{
+  uint32_t off = b.align();
+  b.u32(0);
+  b.f32(1);
+  b.u32(atk);
+  b.u32(rel);
+  b.f32(1);
+  b.f32(0);
+  return off;
+}
+
+static uint32_t addVelRgn(Bytes &b, uint16_t wave)
+{
+  uint32_t off = b.align();
+  b.u8(127);
+  b.zeros(3);
+  b.u16(0);
+  b.u16(wave);
+  b.f32(1);
+  b.f32(1);
+  return off;
+}
+
+static uint32_t addInst(Bytes &b, uint32_t osci, uint16_t wave)
+{
+  uint32_t vel = addVelRgn(b, wave);
+  uint32_t key = b.align();
+  b.u8(127);
+  b.zeros(3);
+  b.u32(1);
+  b.u32(vel);
+  uint32_t off = b.align();
+  b.tag("INST");
+  b.zeros(4);
+  b.f32(0.9);
+  b.f32(1);
+  b.u32(osci);
+  b.zeros(0x14);
+  b.u32(1);
+  b.u32(key);
+  return off;
+}
+
+static Bytes makeBank()
+{
+  Bytes b;
+  b.tag("IBNK");
+  b.zeros(4); // size
+  b.u32(1);   // bank id
+  b.zeros(0x14);
+  b.tag("BANK");
+  uint32_t inst_table = b.size();
+  b.zeros(IBNK::NUM_INSTRUMENTS * 4);
+
+  uint32_t atk = addEnv(b, {{Envp::LINEAR, 20, 32767}, {Envp::LINEAR, 200, 20000}, {Envp::HOLD, 0, 0}});
+  uint32_t atk2 = addEnv(b, {{Envp::ROOT, 10, 32767}, {Envp::SQUARE, 300, 12000}, {Envp::HOLD, 0, 0}});
+  uint32_t rel = addEnv(b, {{Envp::ROOT, 150, 0}, {Envp::STOP, 0, 0}});
+  uint32_t osci = addOsci(b, atk, rel);
+  uint32_t osci2 = addOsci(b, atk2, rel);
+  b.put32(inst_table, addInst(b, osci, 0));
+  b.put32(inst_table + 8, addInst(b, osci2, 2));
+
+  uint32_t keys[128] = {};
+  for (uint32_t k : {36, 38, 42})
+  {
+    uint32_t vel = addVelRgn(b, 1);
+    keys[k] = b.align();
+    b.f32(1);
+    b.f32(1 + (k - 36) * 0.1);
+    b.zeros(8);
+    b.u32(1);
+    b.u32(vel);
+  }
+  uint32_t perc = b.align();
+  b.tag("PER2");
+  b.zeros(0x84);
+  for (uint32_t k : keys) b.u32(k);
+  b.put32(inst_table + 4, perc);
+
+  b.put32(4, b.size());
+  return b;
+}
+
+static void addWave(Bytes &aw, std::vector<FixtureWave> &waves, const std::vector<double> &samples,
+                    uint8_t key, float rate, bool loop, uint32_t loop_start)
+{
+  waves.push_back({key, rate, aw.size(), (uint32_t)samples.size(), loop, loop_start});
+  for (double s : samples)
+  {
+    aw.u16((int16_t)std::max(-32768.0, std::min(32767.0, s)));
+  }
+}
+
+static Bytes makeWaves(Bytes &aw, const char *aw_name)
+{
+  std::vector<FixtureWave> waves;
+  std::vector<double> s;
+  for (uint32_t i = 0; i < 1200; i++)
+    s.push_back(12000 * std::sin(2 * M_PI * i / 40) + 3000 * std::sin(2 * M_PI * i / 13));
+  addWave(aw, waves, s, 60, 32000, true, 200);
+  s.clear();
+  for (uint32_t i = 0; i < 4000; i++)
+    s.push_back(20000 * std::sin(i * 1.7) * std::sin(i * 0.31) * std::exp(-i / 800.0));
+  addWave(aw, waves, s, 60, 22050, false, 0);
+  s.clear();
+  for (uint32_t i = 0; i < 2048; i++)
+    s.push_back(9000 * std::sin(2 * M_PI * i / 64) + ((i / 32) % 2 ? 5000 : -5000));
+  addWave(aw, waves, s, 48, 16000, true, 0);
+
+  Bytes b;
+  b.tag("WSYS");
+  b.zeros(4); // size
+  b.u32(1);   // wave system id
+  b.zeros(0x14);
+  uint32_t winf = b.align();
+  b.tag("WINF");
+  b.u32(1);
+  b.u32(0); // group
+  uint32_t wbct = b.align();
+  b.tag("WBCT");
+  b.zeros(4);
+  b.u32(1);
+  b.u32(0); // scene
+
+  std::vector<uint32_t> infos;
+  for (const FixtureWave &w : waves)
+  {
+    infos.push_back(b.align());
+    b.u8(0);
+    b.u8(3); // 16 bit pcm
+    b.u8(w.key);
+    b.u8(0);
+    b.f32(w.rate);
+    b.u32(w.offset);
+    b.u32(w.count * 2);
+    b.u32(w.loop);
+    b.u32(w.loop_start);
+    b.u32(w.count);
+    b.u32(w.count);
+  }
+  uint32_t group = b.align();
+  uint32_t name = b.size();
+  b.zeros(0x70);
+  memcpy(&b.data[name], aw_name, strlen(aw_name));
+  b.u32(waves.size());
+  for (uint32_t off : infos) b.u32(off);
+  b.put32(winf + 8, group);
+
+  std::vector<uint32_t> entries;
+  for (uint32_t i = 0; i < waves.size(); i++)
+  {
+    entries.push_back(b.align());
+    b.u16(0);
+    b.u16(i);
+  }
+  uint32_t cdf = b.align();
+  b.tag("C-DF");
+  b.u32(entries.size());
+  for (uint32_t off : entries) b.u32(off);
+  uint32_t scene = b.align();
+  b.tag("SCNE");
+  b.zeros(8);
+  b.u32(cdf);
+  b.put32(wbct + 12, scene);
+
+  b.put32(0x10, winf);
+  b.put32(0x14, wbct);
+  b.put32(4, b.size());
+  return b;
+}
+
+static Bytes makeAAF(Bytes &bank, Bytes &wsys)
+{
+  const uint32_t header = 4 * 11;
+  uint32_t bank_off = header;
+  uint32_t wsys_off = (bank_off + bank.size() + 31) / 32 * 32;
+  Bytes b;
+  b.u32(AAFChunk::TYPE_IBNK);
+  b.u32(bank_off);
+  b.u32(bank.size());
+  b.u32(1);
+  b.u32(0);
+  b.u32(AAFChunk::TYPE_WSYS);
+  b.u32(wsys_off);
+  b.u32(wsys.size());
+  b.u32(1);
+  b.u32(0);
+  b.u32(AAFChunk::TYPE_END);
+  b.data.insert(b.data.end(), bank.data.begin(), bank.data.end());
+  b.zeros(wsys_off - b.size());
+  b.data.insert(b.data.end(), wsys.data.begin(), wsys.data.end());
+  return b;
+}
+
+static bool writeFile(const std::string &name, Bytes &b)
+{
+  std::ofstream f(name, std::ios::binary);
+  f.write((const char *)b.data.data(), b.size());
+  return f.good();
+}
+
+bool writeTestBanks(const char *aaf_name, const char *aw_name)
+{
+  Bytes aw;
+  Bytes wsys = makeWaves(aw, aw_name);
+  Bytes bank = makeBank();
+  Bytes aaf = makeAAF(bank, wsys);
+  return writeFile(aaf_name, aaf) && writeFile(aw_name, aw);
+}
@@ -0,0 +1,51 @@
+#ifndef SYNTH_TEST_BANKS_H
+#define SYNTH_TEST_BANKS_H
+
+#include <vector>
+#include <string.h>
+#include <stdint.h>
+
+// big-endian file contents, the way the game data is laid out
+struct Bytes
+{
+  std::vector<uint8_t> data;
+
+  uint32_t size() { return data.size(); }
+
+  void u8(uint8_t v) { data.push_back(v); }
+  void u16(uint16_t v) { u8(v >> 8); u8(v); }
+  void u32(uint32_t v) { u16(v >> 16); u16(v); }
+  void f32(float v) { uint32_t u; memcpy(&u, &v, 4); u32(u); }
+  void zeros(uint32_t count) { data.resize(data.size() + count, 0); }
+  void tag(const char *t) { data.insert(data.end(), t, t + 4); }
+  void ptr24(uint32_t v) { u8(v >> 16); u16(v); }
+
+  // start a 4-byte aligned block, returning its offset
+  uint32_t align()
+  {
+    while (data.size() % 4) u8(0);
+    return data.size();
+  }
+
+  void put32(uint32_t off, uint32_t v)
+  {
+    for (int i = 0; i < 4; i++) data[off + i] = v >> (24 - i * 8);
+  }
+
+  void put24(uint32_t off, uint32_t v)
+  {
+    for (int i = 0; i < 3; i++) data[off + i] = v >> (16 - i * 8);
+  }
+};
+
+/*
+  Writes a bank (id 1) and the wave system it plays from, for tests that
+  need a whole AudioSystem. Instrument 0 plays a looped wave with a
+  linear attack down to a hold; instrument 2 a different looped wave with
+  a root/square attack; instrument 1 is a percussion map with a one-shot
+  wave on keys 36, 38 and 42. All share a root release. Load it with
+  AudioSystem(aaf_name, ".") from the directory it was written to.
+*/
+bool writeTestBanks(const char *aaf_name, const char *aw_name);
+
+#endif // SYNTH_TEST_BANKS_H
@@ -0,0 +1,161 @@
+/*
+  Renders the same notes through VoiceMixer and through Note::render() one at
+  a time, with and without a pitch curve, and checks the two agree. They
+  only differ in the order the lanes and kernel taps are added up, so any
+  difference beyond rounding is a bug.
+*/
+#include "../src/instrument.h"
+#include "../src/voice_mixer.h"
+
+#include <stdio.h>
+#include <cmath>
+#include <vector>
+#include <memory>
+
+static const double TOLERANCE = 1e-9;
+static const uint32_t NUM_NOTES = 11; // not a whole number of lane groups
+
+// a wave laid out the way banks.cpp decodes them, guard samples included
+static void fillWave(Wave &wave, bool loop, uint32_t count, double period)
+{
+  const uint32_t g = Wave::GUARD_SAMPLES;
+  wave.format = Wave::FMT_PCM_16;
+  wave.base_key = 60;
+  wave.sample_rate = 32000;
+  wave.loop = loop;
+  wave.loop_start = loop ? count / 4 : 0;
+  wave.loop_end = count;
+  wave.sample_count = count;
+
+  uint32_t end = loop ? wave.loop_end - 1 : count;
+  wave.data.resize(g + count + g, 1, 0);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    double t = 2 * M_PI * i / period;
+    wave.data[g + i] = 0.6 * std::sin(t) + 0.3 * std::sin(3.7 * t);
+  }
+  if (loop)
+  {
+    uint32_t len = wave.getLoopLength();
+    for (uint32_t i = 0; i < g; i++)
+    {
+      wave.data[g + end + i] = wave.data[g + wave.loop_start + i % len];
+    }
+  }
+}
+
+static void fillOsci(Osci &osci)
+{
+  osci.mode = 0;
+  osci.rate = 1;
+  osci.width = 1;
+  osci.vertex = 0;
+  osci.atkEnv = {{Envp::LINEAR, 20, 32767}, {Envp::SQUARE, 300, 16000}, {Envp::HOLD, 0, 0}};
+  osci.relEnv = {{Envp::LINEAR, 120, 0}, {Envp::STOP, 0, 0}};
+}
+
+static void makeNotes(std::vector<std::unique_ptr<Note>> &notes, Wave *waves, Osci *osci)
+{
+  notes.clear();
+  for (uint32_t i = 0; i < NUM_NOTES; i++)
+  {
+    std::unique_ptr<Note> n = std::make_unique<Note>();
+    n->wave = &waves[i % 2];
+    n->volume = 0.8;
+    n->pitch = 1;
+    n->key = 48 + i * 3;
+    n->vel = 60 + i * 5;
+    n->isPercussion = false;
+    n->env.init(osci);
+    n->setOutputSampleRate(44100);
+    n->pitch_adj = 1 + 0.01 * i;
+    n->start();
+    notes.push_back(std::move(n));
+  }
+}
+
+static bool compare(Interpolator::Mode mode, Wave *waves, Osci *osci)
+{
+  std::vector<std::unique_ptr<Note>> ref_notes;
+  std::vector<std::unique_ptr<Note>> mix_notes;
+  makeNotes(ref_notes, waves, osci);
+  makeNotes(mix_notes, waves, osci);
+
+  VoiceMixer mixer(NUM_NOTES);
+  std::vector<Note *> live;
+  std::vector<stk::StkFloat> ref;
+  std::vector<stk::StkFloat> out;
+  double worst = 0;
+
+  // uneven block lengths, so chunks and loop ends fall all over the place
+  const uint32_t blocks[] = {1, 63, 64, 65, 500, 7, 1024, 333, 2048, 129};
+  // a vibrato-like pitch for some of the notes, changing every chunk
+  std::vector<float> curve(2048 / Note::ENV_CHUNK + 1);
+  for (uint32_t c = 0; c < curve.size(); c++)
+  {
+    curve[c] = 1 + 0.03 * std::sin(c * 0.7);
+  }
+  for (uint32_t b = 0; b < sizeof(blocks) / sizeof(blocks[0]); b++)
+  {
+    uint32_t frames = blocks[b];
+    // release some notes partway through, pitch others
+    for (uint32_t i = 0; i < NUM_NOTES; i++)
+    {
+      if (b == 4 + i % 3)
+      {
+        ref_notes[i]->stop();
+        mix_notes[i]->stop();
+      }
+      ref_notes[i]->pitch_adj = mix_notes[i]->pitch_adj = 1 + 0.01 * i + 0.002 * b;
+      const float *c = (i % 3 == b % 2) ? curve.data() : nullptr;
+      ref_notes[i]->pitch_curve = mix_notes[i]->pitch_curve = c;
+    }
+
+    ref.assign(frames, 0);
+    for (std::unique_ptr<Note> &n : ref_notes)
+    {
+      if (!n->isFinished()) n->render(ref.data(), frames, mode);
+    }
+    out.assign(frames, 0);
+    live.clear();
+    for (std::unique_ptr<Note> &n : mix_notes)
+    {
+      if (!n->isFinished()) live.push_back(n.get());
+    }
+    mixer.mix(live.data(), live.size(), out.data(), frames, mode);
+
+    for (uint32_t i = 0; i < frames; i++)
+    {
+      worst = std::max(worst, std::fabs(ref[i] - out[i]));
+    }
+    for (uint32_t i = 0; i < NUM_NOTES; i++)
+    {
+      if (ref_notes[i]->isFinished() != mix_notes[i]->isFinished())
+      {
+        printf("%s: note %u finished in one renderer only\n", Interpolator::getName(mode), i);
+        return false;
+      }
+    }
+  }
+
+  bool ok = worst <= TOLERANCE;
+  printf("%s: %s, largest difference %g\n", Interpolator::getName(mode), ok ? "ok" : "FAILED", worst);
+  return ok;
+}
+
+int main()
+{
+  Wave waves[2];
+  fillWave(waves[0], true, 1200, 40);
+  fillWave(waves[1], false, 6000, 23);
+  Osci osci;
+  fillOsci(osci);
+
+  printf("voice mixer: %s\n", VoiceMixer::getSimdName());
+  bool ok = true;
+  for (int mode = 0; mode < Interpolator::NUM_MODES; mode++)
+  {
+    ok = compare((Interpolator::Mode)mode, waves, &osci) && ok;
+  }
+  return ok ? 0 : 1;
+}